@@ -0,0 +1,1142 @@
+// Same-Granma-CLI.cc
+// Guillaume-Gentil Robin
+// Command line of Same-Granma: reads the dictionary and the messages on standard input
+// (or answers the clients of a socket) and searches them with the engine (Same-Granma.h)
+//
+// Build the program from the engine, the command line and its tools:
+//   g++ -std=c++11 -O2 -march=native -pthread Same-Granma.cc Same-Granma-CLI.cc Same-Granma-Tools.cc -o Same-Granma
+// See LICENSE AND COPYRIGHT in Same-Granma.cc.
+
+#include "Same-Granma.h"
+#include "Same-Granma-internal.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#if defined(_WIN32)
+#define NO_MMAP   // Standard input is read in blocks instead of being mapped
+#define NO_SERVER // No Unix domain sockets: --server is not available
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Error message constants (those of the engine come from status_text)
+const string UNKNOWN_OPTION("Unknown option: ");
+const string MISSING_VALUE("Missing value for option: ");
+const string INVALID_VALUE("Invalid value for option: ");
+const string INDEX_WRITE_ERROR("Cannot write the index file: ");
+const string SERVER_NEEDS_INDEX("The server reads its dictionary from an index file: --server needs --index");
+const string SERVER_UNAVAILABLE("The server is not available on this system");
+const string SOCKET_ERROR("Cannot listen on the socket: ");
+const string SOCKET_PATH_TAKEN("The socket path is taken by a file that is not a socket: ");
+const string UNKNOWN_COMMAND("Unknown command: ");
+const string DICTIONARY_RELOADED("Dictionary reloaded");
+const string SHARD_UNSUPPORTED("--shard cannot be combined with --recursive, --fewest-words, --totals or --server");
+const string SHARD_WRITE_ERROR("Cannot write the shard file: ");
+
+// Command-line options
+struct Options
+{
+    EngineSettings engine; // Options of the searches, given to the engine
+    bool stats;            // Print search statistics on the error output
+    long long batch;       // Number of messages searched at the same time
+    bool timings;          // Print the search time of each message on the error output
+    string build_index;    // Write the sorted dictionary to this index file and stop
+    string index;          // Read the sorted dictionary from this index file instead of standard input
+    string server;         // Answer the messages sent to this Unix domain socket instead of standard input
+    long long result_cache_mb; // Size of the cache of the results of the server, in megabytes (0 = none)
+    long long benchmark;  // Time generated workloads on dictionaries of up to this number of words (0 = no benchmark)
+    long long seed;       // Seed of the generated workloads of the benchmark
+    long long solvable;   // Percentage of the messages of the benchmark built from dictionary words
+    string shard_file;    // File the shard writes its anagrams and statistics to
+    vector<string> merge; // Shard files to merge into the output of the whole search
+};
+
+// Reader of the words of standard input (separated by white space)
+// When standard input is a file it is mapped, otherwise it is read in blocks of
+// INPUT_BLOCK bytes: memory use does not depend on the size of the input
+struct InputReader
+{
+    vector<char> buffer; // Last block read from standard input
+    const char* data;    // Current block (buffer or mapped file)
+    size_t size;         // Size of the current block
+    size_t position;     // Next character to read in the block
+    bool mapped;         // Standard input is mapped (a single block)
+    bool finished;       // "*" or the end of the input was reached
+};
+
+// A message being searched in batch mode, and its result
+struct BatchSlot
+{
+    string message;      // Words of the message, separated by spaces
+    string result;       // Output of the search
+    double milliseconds; // Time taken by the search
+    bool done;           // The search is finished (guarded by the batch lock)
+};
+
+// Dictionary answering the messages of the server; a reload replaces it as a whole
+// Each query holds it (shared_ptr) until its answer is sent, so a reload never pulls the
+// index from under a search: the old engine goes away with its last query.
+struct ServerDictionary
+{
+    AnagramEngine engine; // Engine on the mapped index file (its idle arenas keep the memo tables)
+    long long generation; // Number of the load: cached results belong to one
+};
+
+// A result of the server, cached under the sorted letters of its message
+struct CachedResult
+{
+    string key;    // Sorted letters of the message
+    string result; // Text of the answer (without the final empty line)
+};
+
+// Results of the server, most recently used first; the least recently used go first
+// when the cache is over max_bytes. Only results of the current dictionary are kept.
+struct ResultCache
+{
+    list<CachedResult> entries;
+    unordered_map<string, list<CachedResult>::iterator> positions; // Entry of each key
+    size_t bytes;          // Size of the keys and results in the cache
+    size_t max_bytes;      // --result-cache
+    long long generation;  // Dictionary of the cached results
+    mutex lock;
+};
+
+// Client of the server, with the part of its input not answered yet
+struct Connection
+{
+    int descriptor;
+    string input;
+};
+
+// Query server: the main thread watches the connections, options.batch workers answer them
+// A connection with input waiting is given to one worker at a time (ready), which answers
+// its complete lines in order and gives it back (returned) to be watched again.
+struct Server
+{
+    shared_ptr<ServerDictionary> dictionary; // Current dictionary (guarded by dictionary_lock)
+    mutex dictionary_lock;
+    mutex reload_lock;             // One reload at a time
+    long long generation;          // Number of the last load (guarded by reload_lock)
+    ResultCache cache;
+    deque<Connection*> ready;      // Connections waiting for a worker (guarded by lock)
+    vector<Connection*> returned;  // Connections answered, to watch again (guarded by lock)
+    mutex lock;
+    condition_variable work;       // Signaled when a connection is ready
+    int wake[2];                   // Pipe waking the main thread when a connection is returned
+};
+
+// Size of the buffer of the standard output
+const size_t OUTPUT_BUFFER(1 << 20);
+
+// Size of the blocks read from standard input
+const size_t INPUT_BLOCK(1 << 16);
+
+// Number of messages read ahead per batch thread
+const long long BATCH_WINDOW(64);
+
+// Longest request line of a server client (longer ones close the connection)
+const size_t MAX_REQUEST(1 << 20);
+
+// === FUNCTION PROTOTYPES ===
+
+// Command-line options
+Options parse_options(int argc, char* argv[]);         // Reads the command-line options
+long long read_number(int argc, char* argv[], int& i); // Reads the value of a numeric option
+string read_value(int argc, char* argv[], int& i);     // Reads the value of an option
+
+// Standard input
+void open_input(InputReader& input);                  // Maps standard input or prepares its buffer
+bool read_token(InputReader& input, string& token);   // Reads the next word of standard input
+bool fill_input(InputReader& input);                  // Reads the next block of standard input
+bool read_message(InputReader& input, string& message); // Reads the next message to analyze
+
+// Messages of standard input
+void process_batch(InputReader& input, AnagramEngine& engine, const Options& options);
+// Searches several messages at the same time and prints their results in input order
+
+void run_shard(InputReader& input, AnagramEngine& engine, const Options& options);
+// Searches the messages on one shard and writes the results to the shard file
+
+void report_time(size_t j, double milliseconds); // Prints the search time of the j-th message
+
+// Query server (--server)
+void run_server(const Options& options);                        // Answers the clients of the socket
+void serve_connections(Server& server, const Options& options); // Work of a server thread
+string answer_request(Server& server, const Options& options, const string& line); // Answer to a request line
+ServerDictionary* load_server_dictionary(const Options& options, long long generation); // nullptr if invalid
+string reload_dictionary(Server& server, const Options& options); // Replaces the dictionary (!reload)
+bool find_result(ResultCache& cache, const string& key, long long generation, string& result);
+void store_result(ResultCache& cache, const string& key, const string& result, long long generation);
+bool send_text(int descriptor, const string& text);             // Sends all the text to a client
+
+int main(int argc, char* argv[])
+{
+    Options options = parse_options(argc, argv);
+    if (!options.server.empty())
+    {
+        // Server mode: the dictionary comes from the index file, the messages from the socket
+        if (options.index.empty())
+        {
+            cerr << SERVER_NEEDS_INDEX << endl;
+            exit(1);
+        }
+        options.engine.threads = 1; // Each message is searched by one thread of the server
+        run_server(options);
+        return 0;
+    }
+
+    // Large buffer on the standard output, flushed after each message
+    static char output_buffer[OUTPUT_BUFFER];
+    ios::sync_with_stdio(false);
+    cout.rdbuf()->pubsetbuf(output_buffer, sizeof(output_buffer));
+    ostream* stats = options.stats ? &cerr : nullptr;
+    if (options.benchmark != 0)
+    {
+        // Generated workloads: standard input is not read
+        GranmaStatus status =
+            granma::run_benchmark(options.engine, options.benchmark, options.seed, options.solvable, cout);
+        if (status != GranmaStatus::FOUND)
+        {
+            cerr << status_text(status) << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (!options.merge.empty())
+    {
+        // The results are in the shard files: standard input is not read
+        string error;
+        if (!granma::merge_shards(options.merge, cout, stats, error))
+        {
+            cerr << error << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if ((options.batch > 1) and !options.engine.recursive)
+    {
+        options.engine.threads = 1; // Each message of a batch is searched by one thread
+    }
+
+    InputReader input;
+    open_input(input);
+
+    AnagramEngine engine;
+    GranmaStatus status;
+    if (!options.index.empty())
+    {
+        // Steps 1 and 2 were done by --build-index: the sorted dictionary is mapped
+        status = engine.load_index(options.index, options.engine);
+        if (status == GranmaStatus::INVALID_INDEX)
+        {
+            cerr << status_text(status) << options.index << endl;
+            exit(1);
+        }
+    }
+    else
+    {
+        // Steps 1 and 2: Dictionary creation (reading of words up to "."), then conversion,
+        // sorting and validation of the dictionary
+        status = engine.load_source([&input](string& word) { return read_token(input, word) and (word != "."); },
+                                    options.engine);
+        if ((status != GranmaStatus::FOUND) and (status != GranmaStatus::INVALID_SETTINGS))
+        {
+            cout << status_text(status) << endl;
+            exit(0);
+        }
+    }
+    if (status != GranmaStatus::FOUND)
+    {
+        cerr << status_text(status) << endl; // Settings refused by the engine
+        exit(1);
+    }
+    if (!options.build_index.empty())
+    {
+        if (!engine.write_index(options.build_index))
+        {
+            cerr << INDEX_WRITE_ERROR << options.build_index << endl;
+            exit(1);
+        }
+        return 0;
+    }
+
+    if (options.engine.shard_count != 0)
+    {
+        run_shard(input, engine, options); // Steps 3 and 4, into the shard file
+        return 0;
+    }
+
+    // Step 3: Display of the sorted dictionary
+    engine.print_dictionary(cout);
+
+    // Step 4: Reading and processing each message as soon as it ends
+    if ((options.batch > 1) and !options.engine.recursive)
+    {
+        process_batch(input, engine, options);
+        return 0;
+    }
+    string message;
+    for (size_t j(0); read_message(input, message); j++)
+    {
+        cout << '\n'; // Empty line after the dictionary and between results of different messages
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        engine.print(message, cout, stats);
+        double milliseconds = granma::elapsed_ms(start);
+        cout.flush();
+        if (options.timings)
+        {
+            report_time(j, milliseconds);
+        }
+    }
+    return 0;
+}
+
+// Reads the command-line options
+// --recursive: use the original recursive search (to compare the output of both engines)
+// --combinations: print each set of words once, in dictionary order
+// --permutations: combination search, then print every word order of each set
+// --fewest-words: print the anagrams of 1 word first, then those of 2 words, and so on
+// --stats: print the number of search nodes of each message on the error output
+// --memo MB: size of the table of states without anagram (default 16, 0 = none)
+// --cache MB: also cache the anagrams of repeated states, up to MB megabytes
+// --threads N: search each message with N threads (same output as with one)
+// --batch N: search N messages at the same time (same output as one by one)
+// --timings: print the search time of each message on the error output
+// --build-index FILE: write the sorted dictionary read on standard input to FILE and stop
+// --index FILE: read the sorted dictionary from FILE; standard input only holds the messages
+// --count: print the number of anagrams of each message instead of the anagrams
+// --totals: count the anagrams of each message (in word orders and in sets of words)
+//           without listing them
+// --first N: stop each message after N anagrams
+// --max-bytes N: stop each message before its anagrams exceed N bytes
+// --max-words N, --min-words N: only anagrams of at most / at least N words
+// --min-length N: only words of at least N letters (required words excepted)
+// --require WORD: every anagram contains WORD, printed first (can be repeated)
+// --exclude WORD: no anagram contains WORD (can be repeated)
+// --time-limit MS, --node-limit N: stop each message after MS milliseconds / N nodes and
+//                                 print what was found, then a truncation status
+// --server SOCKET: answer the messages sent to the Unix domain socket SOCKET (needs --index)
+// --result-cache MB: size of the cache of the results of the server (default 64, 0 = none)
+// --benchmark N: time each phase on generated dictionaries of 1000, 10000, ... up to N words
+//                and print the results in JSON, then stop (standard input is not read)
+// --seed N: seed of the generated workloads of the benchmark (default 1)
+// --solvable P: percentage of solvable messages in the benchmark, the others are random
+//               letters (default 50)
+// --shard I/N: search only the I-th of N shards of the candidates of depth 0 and write
+//              the results to the shard file (see run_shard)
+// --shard-file FILE: shard file (default shard-I-of-N.txt)
+// --merge FILE: print the output of the whole search from its shard files (repeated once
+//               per shard; standard input is not read)
+Options parse_options(int argc, char* argv[])
+{
+    Options options;
+    options.stats = false;
+    options.batch = 1;
+    options.timings = false;
+    options.result_cache_mb = 64;
+    options.benchmark = 0;
+    options.seed = 1;
+    options.solvable = 50;
+    EngineSettings& engine = options.engine; // Default settings of the engine
+    for (int i(1); i < argc; i++)
+    {
+        string argument(argv[i]);
+        if (argument == "--recursive")
+        {
+            engine.recursive = true;
+        }
+        else if (argument == "--combinations")
+        {
+            engine.combinations = true;
+        }
+        else if (argument == "--permutations")
+        {
+            engine.combinations = true;
+            engine.permutations = true;
+        }
+        else if (argument == "--fewest-words")
+        {
+            engine.fewest_words = true;
+        }
+        else if (argument == "--stats")
+        {
+            options.stats = true;
+        }
+        else if ((argument == "--memo") or (argument == "--cache"))
+        {
+            long long size = read_number(argc, argv, i);
+            if (size > 1024 * 1024)
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+            (argument == "--memo" ? engine.memo_mb : engine.cache_mb) = size;
+        }
+        else if (argument == "--threads")
+        {
+            engine.threads = read_number(argc, argv, i);
+            if ((engine.threads < 1) or (engine.threads > 1024))
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+        }
+        else if (argument == "--batch")
+        {
+            options.batch = read_number(argc, argv, i);
+            if ((options.batch < 1) or (options.batch > 1024))
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+        }
+        else if (argument == "--timings")
+        {
+            options.timings = true;
+        }
+        else if (argument == "--count")
+        {
+            engine.count = true;
+        }
+        else if (argument == "--totals")
+        {
+            engine.totals = true;
+        }
+        else if ((argument == "--first") or (argument == "--max-bytes") or (argument == "--time-limit") or
+                 (argument == "--node-limit"))
+        {
+            long long limit = read_number(argc, argv, i);
+            if (limit < 1)
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+            (argument == "--first"        ? engine.first
+             : argument == "--max-bytes"  ? engine.max_bytes
+             : argument == "--time-limit" ? engine.time_limit
+                                          : engine.node_limit) = limit;
+        }
+        else if ((argument == "--max-words") or (argument == "--min-words") or (argument == "--min-length"))
+        {
+            long long limit = read_number(argc, argv, i);
+            if ((limit < 1) or (limit > granma::MAX_MESSAGE_LETTERS))
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+            (argument == "--max-words"   ? engine.max_words
+             : argument == "--min-words" ? engine.min_words
+                                         : engine.min_length) = limit;
+        }
+        else if ((argument == "--require") or (argument == "--exclude"))
+        {
+            string element = read_value(argc, argv, i);
+            if (!granma::is_capital_letter(element))
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+            (argument == "--require" ? engine.required : engine.excluded).push_back(element);
+        }
+        else if (argument == "--build-index")
+        {
+            options.build_index = read_value(argc, argv, i);
+        }
+        else if (argument == "--index")
+        {
+            options.index = read_value(argc, argv, i);
+        }
+        else if (argument == "--server")
+        {
+            options.server = read_value(argc, argv, i);
+        }
+        else if (argument == "--result-cache")
+        {
+            options.result_cache_mb = read_number(argc, argv, i);
+            if ((options.result_cache_mb < 0) or (options.result_cache_mb > 1024 * 1024))
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+        }
+        else if ((argument == "--benchmark") or (argument == "--seed"))
+        {
+            long long value = read_number(argc, argv, i);
+            if ((value < 1) or (value > 100000000))
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+            (argument == "--benchmark" ? options.benchmark : options.seed) = value;
+        }
+        else if (argument == "--solvable")
+        {
+            options.solvable = read_number(argc, argv, i);
+            if ((options.solvable < 0) or (options.solvable > 100))
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+        }
+        else if (argument == "--shard")
+        {
+            string value = read_value(argc, argv, i);
+            char rest;
+            if ((sscanf(value.c_str(), "%lld/%lld%c", &engine.shard_index, &engine.shard_count, &rest) != 2) or
+                (engine.shard_index < 1) or (engine.shard_index > engine.shard_count) or
+                (engine.shard_count > 1000000))
+            {
+                cerr << INVALID_VALUE << argument << endl;
+                exit(1);
+            }
+        }
+        else if (argument == "--shard-file")
+        {
+            options.shard_file = read_value(argc, argv, i);
+        }
+        else if (argument == "--merge")
+        {
+            options.merge.push_back(read_value(argc, argv, i));
+        }
+        else
+        {
+            cerr << UNKNOWN_OPTION << argument << endl;
+            exit(1);
+        }
+    }
+    if (engine.shard_count != 0)
+    {
+        // A shard lists its part of the anagrams with the stack-based engine
+        if (engine.recursive or engine.fewest_words or engine.totals or !options.server.empty())
+        {
+            cerr << SHARD_UNSUPPORTED << endl;
+            exit(1);
+        }
+        if (options.shard_file.empty())
+        {
+            options.shard_file =
+                "shard-" + to_string(engine.shard_index) + "-of-" + to_string(engine.shard_count) + ".txt";
+        }
+    }
+    return options;
+}
+
+// Reads the non-negative integer following the option argv[i] and moves i past it
+long long read_number(int argc, char* argv[], int& i)
+{
+    string option(argv[i]);
+    string value = read_value(argc, argv, i);
+    long long number(0);
+    for (auto digit : value)
+    {
+        if ((digit < '0') or (digit > '9') or (number > 1000000000000LL))
+        {
+            cerr << INVALID_VALUE << option << endl;
+            exit(1);
+        }
+        number = 10 * number + (digit - '0');
+    }
+    if (value.empty())
+    {
+        cerr << INVALID_VALUE << option << endl;
+        exit(1);
+    }
+    return number;
+}
+
+// Reads the value following the option argv[i] and moves i past it
+string read_value(int argc, char* argv[], int& i)
+{
+    if (i + 1 >= argc)
+    {
+        cerr << MISSING_VALUE << argv[i] << endl;
+        exit(1);
+    }
+    i += 1;
+    return argv[i];
+}
+
+// Maps standard input when it is a regular file, otherwise prepares the block buffer
+void open_input(InputReader& input)
+{
+    input.data = nullptr;
+    input.size = 0;
+    input.position = 0;
+    input.mapped = false;
+    input.finished = false;
+#ifndef NO_MMAP
+    struct stat status;
+    if ((fstat(STDIN_FILENO, &status) == 0) and S_ISREG(status.st_mode) and (status.st_size > 0))
+    {
+        off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR); // Input already consumed by the caller
+        void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+        if ((offset >= 0) and (offset <= status.st_size) and (mapping != MAP_FAILED))
+        {
+            madvise(mapping, status.st_size, MADV_SEQUENTIAL); // Read once, front to back
+            input.data = static_cast<const char*>(mapping);
+            input.size = status.st_size;
+            input.position = offset;
+            input.mapped = true;
+            return;
+        }
+        if (mapping != MAP_FAILED)
+        {
+            munmap(mapping, status.st_size);
+        }
+    }
+#endif
+    input.buffer.resize(INPUT_BLOCK);
+}
+
+// Reads the next word of standard input into token (white space separates words)
+// Returns false at the end of the input
+bool read_token(InputReader& input, string& token)
+{
+    token.clear();
+    // Skip the white space before the word
+    do
+    {
+        while (input.position < input.size)
+        {
+            if (!isspace(static_cast<unsigned char>(input.data[input.position])))
+            {
+                break;
+            }
+            input.position += 1;
+        }
+    } while ((input.position == input.size) and fill_input(input));
+    if (input.position == input.size)
+    {
+        return false;
+    }
+    // Copy the word, which can continue in the next block
+    do
+    {
+        size_t start = input.position;
+        while ((input.position < input.size) and !isspace(static_cast<unsigned char>(input.data[input.position])))
+        {
+            input.position += 1;
+        }
+        token.append(input.data + start, input.position - start);
+    } while ((input.position == input.size) and fill_input(input));
+    return true;
+}
+
+// Reads the next block of standard input into the buffer
+// Returns false at the end of the input (a mapped input is a single block)
+bool fill_input(InputReader& input)
+{
+    if (input.mapped)
+    {
+        return false;
+    }
+    input.data = input.buffer.data();
+    input.size = fread(input.buffer.data(), 1, input.buffer.size(), stdin);
+    input.position = 0;
+    return input.size > 0;
+}
+
+// Reads the next message to analyze from standard input into message, its words
+// separated by spaces
+// Format: words separated by spaces, "." ends a message, "*" ends all messages
+// (a last message may end with "*" or with the end of the input instead of ".")
+// Returns false when there is no message left
+bool read_message(InputReader& input, string& message)
+{
+    string element;
+    message.clear();
+    while (!input.finished)
+    {
+        if (!read_token(input, element) or (element == "*"))
+        { // End of all messages
+            input.finished = true;
+            return !message.empty(); // Last message
+        }
+        else if (element == ".")
+        { // End of a message
+            return true;
+        }
+        else
+        { // New word of current message
+            message += message.empty() ? element : ' ' + element;
+        }
+    }
+    return false;
+}
+
+// Batch mode: options.batch threads take the messages in turn and search them with the
+// engine, each search with its own arena (the engine keeps one per thread).
+// The main thread reads the messages into a ring of slots (BATCH_WINDOW per thread, so
+// memory does not grow with the number of messages). Each message is printed into its
+// slot; the main thread prints the slots in input order, with the usual empty lines,
+// as soon as they are complete, and reuses them for the next messages.
+void process_batch(InputReader& input, AnagramEngine& engine, const Options& options)
+{
+    vector<BatchSlot> slots(options.batch * BATCH_WINDOW);
+    size_t nb_read(0);     // Messages read (guarded by lock)
+    size_t nb_taken(0);    // Messages taken by a thread (guarded by lock)
+    bool input_end(false); // No message left to read (guarded by lock)
+    mutex lock;
+    condition_variable work; // Signaled when a message is read or the input ends
+    condition_variable ready; // Signaled when a message is done
+    ostream* stats = options.stats ? &cerr : nullptr;
+
+    vector<thread> workers;
+    for (long long w(0); w < options.batch; w++)
+    {
+        workers.push_back(thread([&]()
+        {
+            unique_lock<mutex> guard(lock);
+            while (true)
+            {
+                work.wait(guard, [&] { return (nb_taken < nb_read) or input_end; });
+                if (nb_taken == nb_read)
+                {
+                    return; // All messages taken
+                }
+                BatchSlot& slot = slots[nb_taken % slots.size()];
+                nb_taken += 1;
+                guard.unlock();
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                engine.print(slot.message, slot.result, stats);
+                slot.milliseconds = granma::elapsed_ms(start);
+                guard.lock();
+                slot.done = true;
+                ready.notify_all();
+            }
+        }));
+    }
+
+    size_t nb_printed(0);
+    unique_lock<mutex> guard(lock);
+    while (!input_end or (nb_printed < nb_read))
+    {
+        BatchSlot& oldest = slots[nb_printed % slots.size()];
+        if ((nb_printed < nb_read) and (oldest.done or input_end or (nb_read - nb_printed == slots.size())))
+        {
+            // Print the oldest message (waiting for it if no other can be read)
+            ready.wait(guard, [&] { return oldest.done; });
+            guard.unlock();
+            cout << '\n'; // Empty line after the dictionary and between results of different messages
+            cout << oldest.result;
+            cout.flush();
+            string().swap(oldest.result); // Free the printed buffer
+            if (options.timings)
+            {
+                report_time(nb_printed, oldest.milliseconds);
+            }
+            guard.lock();
+            nb_printed += 1;
+        }
+        else
+        {
+            // Read the next messages into the free slots (only this thread writes nb_read,
+            // and the threads do not touch the slots from nb_read on)
+            size_t first(nb_read);
+            size_t last(nb_read);
+            bool found(true);
+            guard.unlock();
+            while (found and (last - nb_printed < slots.size()) and (last - first < size_t(options.batch)))
+            {
+                BatchSlot& slot = slots[last % slots.size()];
+                found = read_message(input, slot.message);
+                if (found)
+                {
+                    slot.done = false;
+                    last += 1;
+                }
+            }
+            guard.lock();
+            nb_read = last;
+            input_end = !found;
+            work.notify_all();
+        }
+    }
+    guard.unlock();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+// Sharded search (--shard I/N): the engine searches the messages on shard I of N and
+// writes their records to the shard file, after its header (see AnagramEngine::write_shard);
+// --merge then prints from the files of all the shards exactly what one process prints.
+void run_shard(InputReader& input, AnagramEngine& engine, const Options& options)
+{
+    ofstream file(options.shard_file, ios::binary);
+    if (!file)
+    {
+        cerr << SHARD_WRITE_ERROR << options.shard_file << endl;
+        exit(1);
+    }
+    engine.write_shard_header(file);
+    string message;
+    for (size_t j(0); read_message(input, message); j++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        engine.write_shard(j, message, file, options.stats ? &cerr : nullptr);
+        double milliseconds = granma::elapsed_ms(start);
+        if (!file)
+        {
+            cerr << SHARD_WRITE_ERROR << options.shard_file << endl;
+            exit(1);
+        }
+        if (options.timings)
+        {
+            report_time(j, milliseconds);
+        }
+    }
+}
+
+// Prints the search time of the j-th message (counted from 1) on the error output
+void report_time(size_t j, double milliseconds)
+{
+    cerr << "message " << j + 1 << ": " << milliseconds << " ms" << endl;
+}
+
+#ifndef NO_SERVER
+// Server mode: the index file is mapped once, then the clients of the Unix domain socket
+// send messages, one per line (words separated by spaces, a final "." is optional).
+// Each answer is what the program prints for the message, followed by an empty line.
+// options.batch threads answer the clients, each message searched by one thread.
+// Answers are cached under the sorted letters of their message (the same letters have the
+// same anagrams), so repeated and permuted messages are answered without a search.
+// The line "!reload" maps the index file again (rebuilt by --build-index) and replaces the
+// dictionary; the queries already running finish on the old one.
+// The server runs until it is stopped.
+void run_server(const Options& options)
+{
+    Server server;
+    server.generation = 1;
+    ServerDictionary* loaded = load_server_dictionary(options, server.generation);
+    if (loaded == nullptr)
+    {
+        cerr << status_text(GranmaStatus::INVALID_INDEX) << options.index << endl;
+        exit(1);
+    }
+    server.dictionary = shared_ptr<ServerDictionary>(loaded);
+    server.cache.bytes = 0;
+    server.cache.max_bytes = options.result_cache_mb * 1024 * 1024;
+    server.cache.generation = server.generation;
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((listener < 0) or (options.server.size() >= sizeof(address.sun_path)) or (pipe(server.wake) != 0))
+    {
+        cerr << SOCKET_ERROR << options.server << endl;
+        exit(1);
+    }
+    strcpy(address.sun_path, options.server.c_str());
+    struct stat existing;
+    if (lstat(address.sun_path, &existing) == 0)
+    {
+        if (!S_ISSOCK(existing.st_mode))
+        {
+            cerr << SOCKET_PATH_TAKEN << options.server << endl;
+            exit(1);
+        }
+        unlink(address.sun_path); // Socket left by a previous server
+    }
+    if ((bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) or
+        (listen(listener, SOMAXCONN) != 0))
+    {
+        cerr << SOCKET_ERROR << options.server << endl;
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN); // A client that leaves early is only a failed send
+
+    vector<thread> workers;
+    for (long long w(0); w < options.batch; w++)
+    {
+        workers.push_back(thread(serve_connections, ref(server), cref(options)));
+    }
+
+    // Watch the socket, the wake pipe and the connections that no worker holds
+    vector<Connection*> idle;
+    vector<pollfd> watched;
+    while (true)
+    {
+        watched.assign(2 + idle.size(), pollfd());
+        watched[0].fd = listener;
+        watched[1].fd = server.wake[0];
+        for (size_t i(0); i < idle.size(); i++)
+        {
+            watched[2 + i].fd = idle[i]->descriptor;
+        }
+        for (auto& element : watched)
+        {
+            element.events = POLLIN;
+        }
+        if (poll(watched.data(), watched.size(), -1) < 0)
+        {
+            continue; // Interrupted by a signal
+        }
+        vector<Connection*> still_idle;
+        unique_lock<mutex> guard(server.lock);
+        for (size_t i(0); i < idle.size(); i++)
+        {
+            if (watched[2 + i].revents != 0)
+            {
+                server.ready.push_back(idle[i]); // Input or end of the connection
+            }
+            else
+            {
+                still_idle.push_back(idle[i]);
+            }
+        }
+        idle.swap(still_idle);
+        if (watched[1].revents != 0)
+        {
+            char drained[64];
+            if (read(server.wake[0], drained, sizeof(drained)) > 0)
+            {
+                idle.insert(idle.end(), server.returned.begin(), server.returned.end());
+                server.returned.clear();
+            }
+        }
+        guard.unlock();
+        server.work.notify_all();
+        if (watched[0].revents != 0)
+        {
+            int descriptor = accept(listener, nullptr, nullptr);
+            if (descriptor >= 0)
+            {
+                Connection* connection = new Connection;
+                connection->descriptor = descriptor;
+                idle.push_back(connection);
+            }
+        }
+    }
+}
+
+// Work of a server thread: reads what a ready connection sent and answers its complete
+// lines, then gives the connection back to the main thread (or closes it)
+void serve_connections(Server& server, const Options& options)
+{
+    vector<char> block(INPUT_BLOCK);
+    while (true)
+    {
+        unique_lock<mutex> guard(server.lock);
+        server.work.wait(guard, [&] { return !server.ready.empty(); });
+        Connection* connection = server.ready.front();
+        server.ready.pop_front();
+        guard.unlock();
+
+        ssize_t size = read(connection->descriptor, block.data(), block.size());
+        bool open = (size > 0);
+        if (open)
+        {
+            connection->input.append(block.data(), size);
+            size_t end;
+            while (open and ((end = connection->input.find('\n')) != string::npos))
+            {
+                string line = connection->input.substr(0, end);
+                connection->input.erase(0, end + 1);
+                open = send_text(connection->descriptor, answer_request(server, options, line) + "\n");
+            }
+            open = open and (connection->input.size() <= MAX_REQUEST);
+        }
+        if (!open)
+        {
+            close(connection->descriptor); // End of the client, or error
+            delete connection;
+            continue;
+        }
+        guard.lock();
+        server.returned.push_back(connection);
+        guard.unlock();
+        if (write(server.wake[1], "", 1) < 0)
+        {
+            continue; // The main thread is woken anyway by the next event
+        }
+    }
+}
+
+// Answer to a request line of a client: the output of the program for the message of
+// the line, or the reply to a command (commands start with "!", which no message does)
+string answer_request(Server& server, const Options& options, const string& line)
+{
+    vector<string> message;
+    istringstream words(line);
+    string element;
+    while (words >> element)
+    {
+        message.push_back(element);
+    }
+    if (!message.empty() and (message.back() == "."))
+    {
+        message.pop_back(); // End of the message
+    }
+    if (!message.empty() and (message[0][0] == '!'))
+    {
+        if ((message.size() == 1) and (message[0] == "!reload"))
+        {
+            return reload_dictionary(server, options);
+        }
+        return UNKNOWN_COMMAND + message[0] + "\n";
+    }
+
+    shared_ptr<ServerDictionary> dictionary;
+    {
+        lock_guard<mutex> guard(server.dictionary_lock);
+        dictionary = server.dictionary;
+    }
+
+    // Only messages in capital letters are cached, under their sorted letters
+    bool cached(server.cache.max_bytes > 0);
+    string key, text;
+    for (auto& word : message)
+    {
+        cached = cached and granma::is_capital_letter(word);
+        key += word;
+        text += text.empty() ? word : ' ' + word;
+    }
+    string result;
+    if (cached)
+    {
+        key = granma::sort_letters(key);
+        if (find_result(server.cache, key, dictionary->generation, result))
+        {
+            return result;
+        }
+    }
+    GranmaStatus status = dictionary->engine.print(text, result, options.stats ? &cerr : nullptr);
+    if (cached and (status != GranmaStatus::TRUNCATED)) // A truncated search may find more next time
+    {
+        store_result(server.cache, key, result, dictionary->generation);
+    }
+    return result;
+}
+
+// Loads the index file of the options into a new engine with the settings of the options
+// Returns nullptr if the file is not a valid index
+ServerDictionary* load_server_dictionary(const Options& options, long long generation)
+{
+    ServerDictionary* dictionary = new ServerDictionary;
+    if (dictionary->engine.load_index(options.index, options.engine) != GranmaStatus::FOUND)
+    {
+        delete dictionary;
+        return nullptr;
+    }
+    dictionary->generation = generation;
+    return dictionary;
+}
+
+// Maps the index file again and makes it the dictionary of the next queries (!reload)
+// The cache is emptied first, and the queries still running on the old dictionary cannot
+// store their results (their generation is over). If the file is not valid, the server
+// keeps its dictionary.
+string reload_dictionary(Server& server, const Options& options)
+{
+    lock_guard<mutex> reloading(server.reload_lock);
+    ServerDictionary* loaded = load_server_dictionary(options, server.generation + 1);
+    if (loaded == nullptr)
+    {
+        return status_text(GranmaStatus::INVALID_INDEX) + options.index + "\n";
+    }
+    server.generation += 1;
+    {
+        lock_guard<mutex> guard(server.cache.lock);
+        server.cache.entries.clear();
+        server.cache.positions.clear();
+        server.cache.bytes = 0;
+        server.cache.generation = server.generation;
+    }
+    shared_ptr<ServerDictionary> replaced(loaded);
+    {
+        lock_guard<mutex> guard(server.dictionary_lock);
+        server.dictionary.swap(replaced);
+    }
+    return DICTIONARY_RELOADED + "\n"; // The old dictionary goes with its last query
+}
+
+// Looks the result of a message up in the cache (and makes it the most recently used)
+bool find_result(ResultCache& cache, const string& key, long long generation, string& result)
+{
+    lock_guard<mutex> guard(cache.lock);
+    auto found = cache.positions.find(key);
+    if ((cache.generation != generation) or (found == cache.positions.end()))
+    {
+        return false;
+    }
+    cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+    result = found->second->result;
+    return true;
+}
+
+// Adds the result of a message to the cache, removing the least recently used results
+// to stay within its size (a result larger than the whole cache is not kept)
+void store_result(ResultCache& cache, const string& key, const string& result, long long generation)
+{
+    size_t size = key.size() + result.size();
+    lock_guard<mutex> guard(cache.lock);
+    if ((cache.generation != generation) or (size > cache.max_bytes) or (cache.positions.count(key) != 0))
+    {
+        return; // Old dictionary, too large, or stored by another thread meanwhile
+    }
+    while (cache.bytes + size > cache.max_bytes)
+    {
+        CachedResult& oldest = cache.entries.back();
+        cache.bytes -= oldest.key.size() + oldest.result.size();
+        cache.positions.erase(oldest.key);
+        cache.entries.pop_back();
+    }
+    cache.entries.push_front(CachedResult());
+    cache.entries.front().key = key;
+    cache.entries.front().result = result;
+    cache.positions[key] = cache.entries.begin();
+    cache.bytes += size;
+}
+
+// Sends all the text to a client
+// Returns false if the client is gone
+bool send_text(int descriptor, const string& text)
+{
+    size_t sent(0);
+    while (sent < text.size())
+    {
+        ssize_t size = write(descriptor, text.data() + sent, text.size() - sent);
+        if (size <= 0)
+        {
+            return false;
+        }
+        sent += size;
+    }
+    return true;
+}
+#else
+// Without Unix domain sockets there is no server mode
+void run_server(const Options&)
+{
+    cerr << SERVER_UNAVAILABLE << endl;
+    exit(1);
+}
+#endif
@@ -0,0 +1,361 @@
+// Same-Granma-Test.cc
+// Guillaume-Gentil Robin
+// Regression check of the dictionary sort of the engine (Same-Granma-internal.h): sorts
+// generated dictionaries with sort_dictionary and compares the order with the one of the
+// four bubble sorts of version 4.1, kept below as the reference
+//
+// Build and run it with the engine:
+//   g++ -std=c++11 -O2 -march=native -pthread Same-Granma.cc Same-Granma-Test.cc -o Same-Granma-Test
+//   ./Same-Granma-Test [MAX_WORDS [SEED]]
+// See LICENSE AND COPYRIGHT in Same-Granma.cc.
+
+#include "Same-Granma-internal.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <random>
+#include <unordered_set>
+
+using namespace std;
+
+// Dictionary sizes checked: 1000, 10000, ... below MAX_WORDS, then MAX_WORDS itself
+// The reference sorts take quadratic time, hence the small default
+const long long SMALLEST_SIZE(1000);
+const long long DEFAULT_MAX_WORDS(3000);
+
+// Reference order: the dictionary sort of version 4.1 (four bubble sorts, one per key)
+namespace original
+{
+
+// Structure representing a word with its properties for search optimization
+struct Word
+{
+    string word;  // The original word
+    int nbT;      // Total number of letters (Total)
+    int nbD;      // Number of distinct letters (Different)
+    string alpha; // Letters of the word sorted alphabetically (e.g., "CAB" -> "ABC")
+};
+
+vector<Word> convert(vector<string> list);  // Transforms a list of strings into a dictionary of Word structures
+int count_distinct_letters(string element); // Calculates the number of distinct letters in a word
+string sort_letters(string element);        // Sorts the letters of a word alphabetically
+
+vector<Word> sort_by_total(vector<Word> dict);       // Sort by total number of letters
+vector<Word> sort_by_distinct(vector<Word> dict);    // Sort by number of distinct letters
+vector<Word> sort_by_alpha(vector<Word> dict);       // Sort by sorted letters order
+vector<Word> sort_alphabetically(vector<Word> dict); // Alphabetical sort of the original word
+
+} // namespace original
+
+// === FUNCTION PROTOTYPES ===
+
+vector<string> generate_words(mt19937_64& random, long long nb_words, int kind); // Shuffled distinct words
+bool check_order(const vector<string>& words, ostream& out); // Compares the two sorts of the words
+
+// Checks the sort on generated dictionaries of every size, with uniform letters, with
+// only 4 letters (many words share their first keys) and with anagram groups (up to 8
+// words with the same letters, where only the last key decides)
+// Exit code 1 at the first difference
+int main(int argc, char* argv[])
+{
+    long long max_words = (argc > 1) ? atoll(argv[1]) : DEFAULT_MAX_WORDS;
+    long long seed = (argc > 2) ? atoll(argv[2]) : 1;
+    if (max_words < 2)
+    {
+        cerr << "Usage: " << argv[0] << " [MAX_WORDS (at least 2) [SEED]]" << endl;
+        return 1;
+    }
+    vector<long long> sizes;
+    for (long long size(SMALLEST_SIZE); size < max_words; size *= 10)
+    {
+        sizes.push_back(size);
+    }
+    sizes.push_back(max_words);
+    const char* kinds[] = {"uniform", "4-letters", "anagrams"};
+    for (auto nb_words : sizes)
+    {
+        for (int kind(0); kind < 3; kind++)
+        {
+            mt19937_64 random(seed * 1000003 + nb_words * 3 + kind);
+            vector<string> words = generate_words(random, nb_words, kind);
+            cout << "sort " << kinds[kind] << ' ' << words.size() << " words: ";
+            if (!check_order(words, cout))
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Generates nb_words distinct words of 2 to 10 letters in random order: drawn from the
+// 26 letters (kind 0) or from 4 of them (kind 1; fewer if they run out), or shuffles of
+// the letters of fewer words (kind 2)
+vector<string> generate_words(mt19937_64& random, long long nb_words, int kind)
+{
+    unordered_set<string> seen;
+    vector<string> words;
+    string element;
+    int nb_letters = (kind == 1) ? 4 : granma::NB_LETTERS;
+    for (long long attempt(0); ((long long)words.size() < nb_words) and (attempt < nb_words * 100); attempt++)
+    {
+        element.clear();
+        int size = 2 + random() % 9;
+        for (int k(0); k < size; k++)
+        {
+            element.push_back('A' + random() % nb_letters);
+        }
+        for (int copy(0); (copy < ((kind == 2) ? 8 : 1)) and ((long long)words.size() < nb_words); copy++)
+        {
+            for (size_t k(element.size()); k > 1; k--)
+            {
+                swap(element[k - 1], element[random() % k]);
+            }
+            if (seen.insert(element).second)
+            {
+                words.push_back(element);
+            }
+        }
+    }
+    for (size_t k(words.size()); k > 1; k--)
+    {
+        swap(words[k - 1], words[random() % k]);
+    }
+    return words;
+}
+
+// Sorts the words with sort_dictionary and with the four original sorts, and prints OK
+// or the first word where they differ
+// Returns true if the orders are the same
+bool check_order(const vector<string>& words, ostream& out)
+{
+    granma::Dictionary dict;
+    for (auto& word : words)
+    {
+        granma::add_word(dict, word.data(), word.size());
+    }
+    granma::convert(dict);
+    granma::sort_dictionary(dict);
+
+    vector<original::Word> expected = original::convert(words);
+    expected = original::sort_by_total(expected);
+    expected = original::sort_by_distinct(expected);
+    expected = original::sort_by_alpha(expected);
+    expected = original::sort_alphabetically(expected);
+
+    for (size_t i(0); i < expected.size(); i++)
+    {
+        string word(dict.pool.data() + dict.offsets[i], dict.nbT[i]);
+        if (word != expected[i].word)
+        {
+            out << "word " << i << " is " << word << " instead of " << expected[i].word << endl;
+            return false;
+        }
+    }
+    out << "OK" << endl;
+    return true;
+}
+
+namespace original
+{
+
+// Converts a list of strings into a dictionary of Word structures
+// Calculates for each word: nbT, nbD, alpha
+vector<Word> convert(vector<string> list)
+{
+    Word w;
+    vector<Word> dict;
+
+    for (auto element : list)
+    {
+        w.word = element;                        // Original word
+        w.nbT = element.size();                  // Total number of letters
+        w.nbD = count_distinct_letters(element); // Number of distinct letters
+        w.alpha = sort_letters(element);         // Letters sorted alphabetically
+        dict.push_back(w);
+    }
+    return dict;
+}
+
+// Calculates the number of distinct letters in a word
+// Example: "HELLO" -> 4 distinct letters (H, E, L, O)
+int count_distinct_letters(string element)
+{
+    vector<char> distinct_chars;
+    bool new_character;
+    distinct_chars.push_back(element[0]); // First letter always added
+    for (auto letter1 : element)
+    {
+        new_character = true;
+        // Check if the letter is already in the list
+        for (auto letter2 : distinct_chars)
+        {
+            if (letter1 == letter2)
+            {
+                new_character = false;
+            }
+        }
+        if (new_character)
+        {
+            distinct_chars.push_back(letter1);
+        }
+    }
+    return distinct_chars.size();
+}
+
+// Sorts the letters of a word alphabetically
+// Example: "CAB" -> "ABC", "HELLO" -> "EHLLO"
+// Uses insertion sort
+string sort_letters(string element)
+{
+    string characters;
+    characters.push_back(element[0]); // First letter
+    bool loop(true);
+    size_t j(0);
+    // For each following letter, find its position in alphabetical order
+    for (size_t i(1); i < element.size(); i++)
+    {
+        loop = true;
+        j = 0;
+        while (loop)
+        {
+            if (j >= characters.size())
+            {
+                // Larger than all existing letters: add to the end
+                characters.push_back(element[i]);
+                loop = false;
+            }
+            else
+            {
+                if (characters[j] > element[i])
+                {
+                    // Find insertion position
+                    characters.insert(j, 1, element[i]);
+                    loop = false;
+                }
+            }
+            j += 1;
+        }
+    }
+    return characters;
+}
+
+// Sort level 1: by total number of letters (ascending)
+// Uses bubble sort
+vector<Word> sort_by_total(vector<Word> dict)
+{
+    Word temp_element;
+    for (size_t j(0); j < (dict.size() - 1); j++)
+    {
+        for (size_t i(0); i < (dict.size() - 1); i++)
+        {
+            if (dict[i].nbT > dict[i + 1].nbT)
+            {
+                // Swap if current word is longer
+                temp_element = dict[i];
+                dict[i] = dict[i + 1];
+                dict[i + 1] = temp_element;
+            }
+        }
+    }
+    return dict;
+}
+
+// Sort level 2: by number of distinct letters (ascending)
+// Only sorts if nbT is identical (stable sort)
+vector<Word> sort_by_distinct(vector<Word> dict)
+{
+    Word temp_element;
+    for (size_t j(0); j < (dict.size() - 1); j++)
+    {
+        for (size_t i(0); i < (dict.size() - 1); i++)
+        {
+            if ((dict[i].nbD > dict[i + 1].nbD) and (dict[i].nbT == dict[i + 1].nbT))
+            {
+                // Swap only if same length
+                temp_element = dict[i];
+                dict[i] = dict[i + 1];
+                dict[i + 1] = temp_element;
+            }
+        }
+    }
+    return dict;
+}
+
+// Sort level 3: by sorted letters order (alpha)
+// Compares character by character the alphabetized versions
+// Only sorts if nbT and nbD are identical
+// The only change from version 4.1: the comparison stops after the terminating null of
+// two equal alphas (anagrams), where the original read past the end of the strings
+vector<Word> sort_by_alpha(vector<Word> dict)
+{
+    Word temp_element;
+    int alpha1(0);
+    int alpha2(0);
+    size_t h(0);
+    for (size_t j(0); j < (dict.size() - 1); j++)
+    {
+        for (size_t i(0); i < (dict.size() - 1); i++)
+        {
+            alpha1 = 0;
+            alpha2 = 0;
+            h = 0;
+            // Find the first different character
+            while ((alpha1 == alpha2) and (h <= dict[i].alpha.size()) and (h <= dict[i + 1].alpha.size()))
+            {
+                alpha1 = dict[i].alpha[h];
+                alpha2 = dict[i + 1].alpha[h];
+                h += 1;
+            }
+            // Swap if same nbT and nbD, but different alpha
+            if (((alpha1 > alpha2) and (dict[i].nbD == dict[i + 1].nbD)) and
+                (dict[i].nbT == dict[i + 1].nbT))
+            {
+                temp_element = dict[i];
+                dict[i] = dict[i + 1];
+                dict[i + 1] = temp_element;
+            }
+        }
+    }
+    return dict;
+}
+
+// Sort level 4: alphabetical order of the original word
+// Classic lexicographic comparison
+// Only sorts if nbT, nbD and alpha are identical
+vector<Word> sort_alphabetically(vector<Word> dict)
+{
+    Word temp_element;
+    int char1(0);
+    int char2(0);
+    int h(0);
+    for (size_t j(0); j < (dict.size() - 1); j++)
+    {
+        for (size_t i(0); i < (dict.size() - 1); i++)
+        {
+            char1 = 0;
+            char2 = 0;
+            h = 0;
+            // Find the first different character in the original words
+            while (char1 == char2)
+            {
+                char1 = dict[i].word[h];
+                char2 = dict[i + 1].word[h];
+                h += 1;
+            }
+            // Swap if all previous properties are identical
+            if (((char1 > char2) and (dict[i].nbD == dict[i + 1].nbD)) and
+                ((dict[i].nbT == dict[i + 1].nbT) and (dict[i].alpha == dict[i + 1].alpha)))
+            {
+                temp_element = dict[i];
+                dict[i] = dict[i + 1];
+                dict[i + 1] = temp_element;
+            }
+        }
+    }
+    return dict;
+}
+
+} // namespace original
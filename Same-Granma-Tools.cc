@@ -0,0 +1,579 @@
+// Same-Granma-Tools.cc
+// Guillaume-Gentil Robin
+// Tools of the program built on the internals of the engine (Same-Granma-internal.h):
+// the benchmark (--benchmark) and the merge of a sharded search (--merge). They are not
+// part of the library (Same-Granma.h).
+// See LICENSE AND COPYRIGHT in Same-Granma.cc.
+
+#include "Same-Granma-internal.h"
+
+#include <iomanip>
+#include <random>
+#include <unordered_set>
+
+using namespace std;
+
+namespace granma
+{
+
+// Benchmark workloads: dictionary sizes (the first ones below --benchmark), lengths of the
+// messages, messages per length (split by --solvable), and --first of the searches when no
+// output limit is given
+const long long BENCH_SMALLEST(1000);
+const int BENCH_LENGTHS[] = {8, 12, 16};
+const int BENCH_MESSAGES(20);
+const long long BENCH_FIRST(1000);
+
+// Error messages of the merge of a sharded search
+const string INVALID_SHARD("Invalid or incomplete shard file: ");
+const string SHARDS_MISMATCH("The shard files are not the shards 1 to N of the same search");
+
+// Frequencies of the letters in English text, per 10000 letters (English-like workloads)
+const int ENGLISH_FREQUENCIES[NB_LETTERS] = {817, 149, 278, 425, 1270, 223, 202, 609, 697, 15, 77, 403, 241,
+                                             675, 751, 193, 10, 599, 633, 906, 276, 98, 236, 15, 197, 7};
+
+// === FUNCTION PROTOTYPES ===
+
+// Generated workloads
+string generate_dictionary(mt19937_64& random, long long nb_words, bool english); // Text of a random dictionary
+char random_letter(mt19937_64& random, bool english);                      // Letter drawn from a distribution
+string solvable_message(mt19937_64& random, const SearchIndex& index, int size); // Letters of dictionary words
+
+// Shard files (--merge), see AnagramEngine::write_shard and write_record
+bool read_header(istream& file, string& name, vector<unsigned long long>& fields); // false if not a header
+bool read_payload(istream& file, size_t size, string& payload);                 // false if the file ends
+
+// Benchmark mode: times each phase of the program on generated workloads and prints the
+// results in JSON on out, so that versions can be compared
+// Dictionaries of 1000, 10000, ... words up to max_words (and of exactly that many)
+// are generated with English-like and with uniform letters. Each goes through the phases of
+// the program (load: reading its text, convert, sort, index) and is then searched with
+// BENCH_MESSAGES messages of each length of BENCH_LENGTHS, in two groups: "solvable"
+// messages are the shuffled letters of dictionary words, "random" ones are drawn letters
+// (mostly without anagram); solvable percent of the messages are solvable.
+// Each message is filtered (adapt_dictionary), searched counting its anagrams (search),
+// then searched again listing them into memory (output). The search settings
+// apply, except the required and excluded words and the other engines; without an
+// output limit, each search stops after BENCH_FIRST anagrams.
+// The workloads only depend on seed, so runs of different versions compare.
+GranmaStatus run_benchmark(const EngineSettings& settings, long long max_words, long long seed,
+                           long long solvable, ostream& out)
+{
+    Options counting = settings_options(settings);
+    if (!valid_options(counting))
+    {
+        return GranmaStatus::INVALID_SETTINGS;
+    }
+    counting.recursive = false;
+    counting.totals = false;
+    counting.required.clear();
+    counting.excluded.clear();
+    if ((counting.first == 0) and (counting.max_bytes == 0))
+    {
+        counting.first = BENCH_FIRST;
+    }
+    counting.count_only = true;
+    Options listing(counting);
+    listing.count_only = false;
+
+    vector<long long> sizes;
+    for (long long size(BENCH_SMALLEST); size < max_words; size *= 10)
+    {
+        sizes.push_back(size);
+    }
+    sizes.push_back(max_words);
+
+    out << fixed << setprecision(3);
+    out << "{\n  \"seed\": " << seed << ",\n  \"settings\": {\"combinations\": "
+        << (counting.combinations ? "true" : "false") << ", \"permutations\": "
+        << (counting.permutations ? "true" : "false") << ", \"first\": " << counting.first
+        << ", \"max_bytes\": " << counting.max_bytes << ", \"max_words\": " << counting.max_words
+        << ", \"min_words\": " << counting.min_words << ", \"min_length\": " << counting.min_length
+        << ", \"threads\": " << counting.threads << ", \"memo_mb\": " << counting.memo_mb
+        << ", \"time_limit\": " << counting.time_limit << ", \"node_limit\": " << counting.node_limit
+        << ", \"solvable_percent\": " << solvable << "},\n  \"cases\": [";
+    bool first_case(true);
+    for (auto nb_words : sizes)
+    {
+        for (int english(1); english >= 0; english--)
+        {
+            // One generator per case: a case is the same whatever the cases before it
+            mt19937_64 random(seed * 1000003 + nb_words * 2 + english);
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            string text = generate_dictionary(random, nb_words, english);
+            double generate_ms = elapsed_ms(start);
+
+            // The phases of the program on the text of the dictionary, read as standard input
+            Dictionary dict;
+            size_t position(0);
+            auto read_word = [&text, &position](string& word)
+            {
+                while ((position < text.size()) and isspace(static_cast<unsigned char>(text[position])))
+                {
+                    position += 1;
+                }
+                size_t begin(position);
+                while ((position < text.size()) and !isspace(static_cast<unsigned char>(text[position])))
+                {
+                    position += 1;
+                }
+                word.assign(text, begin, position - begin);
+                return (position > begin) and (word != ".");
+            };
+            start = chrono::steady_clock::now();
+            bool capitals = create_dictionary(read_word, dict);
+            double load_ms = elapsed_ms(start);
+            start = chrono::steady_clock::now();
+            convert(dict);
+            double convert_ms = elapsed_ms(start);
+            start = chrono::steady_clock::now();
+            sort_dictionary(dict);
+            GranmaStatus status = check_dictionary(dict, capitals);
+            double sort_ms = elapsed_ms(start);
+            if (status != GranmaStatus::FOUND)
+            {
+                return status; // Not a valid generated dictionary
+            }
+            SearchIndex index;
+            start = chrono::steady_clock::now();
+            create_index(dict, index);
+            double index_ms = elapsed_ms(start);
+
+            resolve_constraints(index, counting);
+            resolve_constraints(index, listing);
+            const ClassTable& classes = select_classes(index, counting);
+            // Separate memories: the listing search must not reuse the states of the counting one
+            vector<SearchArena> counters(counting.threads);
+            vector<SearchArena> listers(listing.threads);
+            for (auto arenas : {&counters, &listers})
+            {
+                for (auto& arena : *arenas)
+                {
+                    init_memo(arena.memo, counting, arena);
+                    arena.output = nullptr;
+                    arena.stats = nullptr;
+                    arena.scheduler = nullptr;
+                    arena.sink.callback = nullptr;
+                    arena.sink.stream = &out;
+                }
+            }
+            auto search = [&](const vector<int>& candidates, const LetterCounts& alpha_m, size_t most_words,
+                              const Options& search_options, vector<SearchArena>& arenas)
+            {
+                reset_sink(arenas[0].sink, search_options);
+                arenas[0].deadline = chrono::steady_clock::now() + chrono::milliseconds(search_options.time_limit);
+                if (arenas.size() > 1)
+                {
+                    return search_anagram_parallel(classes, candidates, alpha_m, most_words, search_options, arenas,
+                                                   index);
+                }
+                return search_anagram_stack(classes, candidates, alpha_m, most_words, search_options, arenas[0],
+                                            index);
+            };
+
+            double filter_total(0), search_total(0), output_total(0);
+            ostringstream groups;
+            groups << fixed << setprecision(3);
+            bool first_group(true);
+            for (int length : BENCH_LENGTHS)
+            {
+                int nb_solvable = (BENCH_MESSAGES * solvable + 50) / 100;
+                for (int solvable_group(1); solvable_group >= 0; solvable_group--)
+                {
+                    int nb_messages = solvable_group ? nb_solvable : BENCH_MESSAGES - nb_solvable;
+                    if (nb_messages == 0)
+                    {
+                        continue; // All the messages are of the other kind
+                    }
+                    double filter_ms(0), search_ms(0), output_ms(0);
+                    unsigned long long anagrams(0), bytes(0), nodes(0);
+                    int with_anagrams(0), truncated(0);
+                    string listed;
+                    for (int j(0); j < nb_messages; j++)
+                    {
+                        string message;
+                        if (solvable_group)
+                        {
+                            message = solvable_message(random, index, length);
+                        }
+                        else
+                        {
+                            for (int k(0); k < length; k++)
+                            {
+                                message.push_back(random_letter(random, english));
+                            }
+                        }
+                        start = chrono::steady_clock::now();
+                        LetterCounts alpha_m = count_letters(message);
+                        size_t most_words(0);
+                        vector<int> candidates = adapt_dictionary(index, classes, alpha_m, counting, most_words);
+                        most_words = min(most_words, message.size());
+                        filter_ms += elapsed_ms(start);
+
+                        start = chrono::steady_clock::now();
+                        with_anagrams += search(candidates, alpha_m, most_words, counting, counters) ? 1 : 0;
+                        search_ms += elapsed_ms(start);
+                        anagrams += counters[0].sink.count;
+                        nodes += counters[0].nodes;
+                        truncated += counters[0].sink.truncated ? 1 : 0;
+
+                        listed.clear();
+                        listers[0].output = &listed;
+                        start = chrono::steady_clock::now();
+                        search(candidates, alpha_m, most_words, listing, listers);
+                        output_ms += elapsed_ms(start);
+                        bytes += listed.size();
+                    }
+                    filter_total += filter_ms;
+                    search_total += search_ms;
+                    output_total += output_ms;
+                    groups << (first_group ? "\n" : ",\n") << "        {\"length\": " << length << ", \"kind\": \""
+                           << (solvable_group ? "solvable" : "random") << "\", \"messages\": " << nb_messages
+                           << ", \"with_anagrams\": " << with_anagrams << ", \"truncated\": " << truncated
+                           << ", \"anagrams\": " << anagrams << ", \"nodes\": " << nodes
+                           << ", \"filter_ms\": " << filter_ms << ", \"search_ms\": " << search_ms
+                           << ", \"output_ms\": " << output_ms << ", \"output_bytes\": " << bytes << "}";
+                    first_group = false;
+                }
+            }
+            out << (first_case ? "\n" : ",\n") << "    {\"words\": " << nb_words << ", \"letters\": \""
+                << (english ? "english" : "uniform") << "\", \"classes\": " << index.classes.size()
+                << ", \"dictionary_bytes\": " << text.size() << ",\n      \"phases_ms\": {\"generate\": "
+                << generate_ms << ", \"load\": " << load_ms << ", \"convert\": " << convert_ms
+                << ", \"sort\": " << sort_ms << ", \"index\": " << index_ms << ", \"filter\": " << filter_total
+                << ", \"search\": " << search_total << ", \"output\": " << output_total
+                << "},\n      \"groups\": [" << groups.str() << "\n      ]}";
+            out.flush();
+            first_case = false;
+        }
+    }
+    out << "\n  ]\n}" << endl;
+    return GranmaStatus::FOUND;
+}
+
+// Generates the text of a dictionary of distinct random words of 2 to 10 letters,
+// terminated by "." as on standard input
+string generate_dictionary(mt19937_64& random, long long nb_words, bool english)
+{
+    unordered_set<string> seen;
+    string text;
+    string element;
+    while ((long long)seen.size() < nb_words)
+    {
+        element.clear();
+        int size = 2 + random() % 9;
+        for (int k(0); k < size; k++)
+        {
+            element.push_back(random_letter(random, english));
+        }
+        if (seen.insert(element).second)
+        {
+            text += element;
+            text.push_back(' ');
+        }
+    }
+    text += ".\n";
+    return text;
+}
+
+// Draws a letter with English frequencies, or with uniform ones
+// Only the generator itself is used (no std distribution), so that every platform draws
+// the same workloads for a seed
+char random_letter(mt19937_64& random, bool english)
+{
+    if (!english)
+    {
+        return 'A' + random() % NB_LETTERS;
+    }
+    int draw = random() % 10000;
+    int letter(0);
+    while ((letter < NB_LETTERS - 1) and (draw >= ENGLISH_FREQUENCIES[letter]))
+    {
+        draw -= ENGLISH_FREQUENCIES[letter];
+        letter += 1;
+    }
+    return 'A' + letter;
+}
+
+// Builds a message of size letters with an anagram: the shuffled letters of distinct
+// random words of the dictionary (shorter if the dictionary has no words that fit)
+string solvable_message(mt19937_64& random, const SearchIndex& index, int size)
+{
+    string message;
+    vector<int> chosen;
+    for (int attempt(0); ((int)message.size() < size) and (attempt < 1000); attempt++)
+    {
+        int i = random() % index.nb_words;
+        int remaining = size - message.size();
+        int letters = index.offsets[i + 1] - index.offsets[i];
+        if ((letters > remaining) or (letters == remaining - 1) or
+            (find(chosen.begin(), chosen.end(), i) != chosen.end()))
+        {
+            continue; // Too long, leaves a single letter, or already in the message
+        }
+        chosen.push_back(i);
+        append_word(message, index, i);
+    }
+    for (size_t k(message.size()); k > 1; k--)
+    {
+        swap(message[k - 1], message[random() % k]);
+    }
+    return message;
+}
+
+// Prints the output of a sharded search from the files of all its shards (--merge, given
+// once per shard, in any order): the dictionary, then for each message the blocks of all
+// the shards in the order of their candidates of depth 0 (the order of one process), kept
+// to the output limits of the search, then how the search ended. A message has anagrams
+// if a shard found some, and is truncated if a shard was. The files are read one block at
+// a time.
+// With stats, also prints there for each message the nodes of the whole search and, for each
+// shard, its part of the candidates and of the estimated cost, its nodes and its time.
+bool merge_shards(const vector<string>& paths, ostream& out, ostream* stats, string& error)
+{
+    size_t nb_shards = paths.size();
+    vector<ifstream> files(nb_shards);
+    vector<int> shard_of(nb_shards);
+    vector<char> seen(nb_shards, 0);
+    Options limits = default_options();
+    string name;
+    vector<unsigned long long> fields;
+    for (size_t k(0); k < nb_shards; k++)
+    {
+        const string& path = paths[k];
+        files[k].open(path, ios::binary);
+        if (!read_header(files[k], name, fields) or (name != SHARD_MAGIC) or (fields.size() != 5))
+        {
+            error = INVALID_SHARD + path;
+            return false;
+        }
+        bool same = (fields[1] == nb_shards) and (fields[0] >= 1) and (fields[0] <= nb_shards) and !seen[fields[0] - 1];
+        if (k == 0)
+        {
+            limits.first = fields[2];
+            limits.max_bytes = fields[3];
+            limits.count_only = (fields[4] != 0);
+        }
+        same = same and (fields[2] == (unsigned long long)limits.first) and
+               (fields[3] == (unsigned long long)limits.max_bytes) and ((fields[4] != 0) == limits.count_only);
+        if (!same)
+        {
+            error = SHARDS_MISMATCH;
+            return false;
+        }
+        seen[fields[0] - 1] = 1;
+        shard_of[k] = fields[0];
+    }
+
+    // The shards display the same dictionary and end the same messages the same way
+    string text, other;
+    for (size_t k(0); k < nb_shards; k++)
+    {
+        if (!read_header(files[k], name, fields) or (name != "dictionary") or (fields.size() != 1) or
+            !read_payload(files[k], fields[0], k == 0 ? text : other))
+        {
+            error = INVALID_SHARD + paths[k];
+            return false;
+        }
+        if ((k != 0) and (other != text))
+        {
+            error = SHARDS_MISMATCH;
+            return false;
+        }
+    }
+    out << text;
+
+    bool limited = (limits.first != 0) or (limits.max_bytes != 0);
+    vector<string> names(nb_shards);
+    vector<vector<unsigned long long>> headers(nb_shards);
+    vector<vector<unsigned long long>> plans(nb_shards);
+    string block, line;
+    for (size_t j(0);; j++)
+    {
+        size_t nb_ended(0);
+        for (size_t k(0); k < nb_shards; k++)
+        {
+            if (files[k].peek() == EOF)
+            {
+                nb_ended += 1;
+                continue;
+            }
+            if (!read_header(files[k], name, fields) or (name != "message") or (fields.size() != 1) or
+                (fields[0] != j))
+            {
+                error = INVALID_SHARD + paths[k];
+                return false;
+            }
+        }
+        if (nb_ended == nb_shards)
+        {
+            break;
+        }
+        if (nb_ended != 0)
+        {
+            error = SHARDS_MISMATCH;
+            return false;
+        }
+        out << '\n'; // Empty line after the dictionary and between results of different messages
+
+        bool searched(false);
+        for (size_t k(0); k < nb_shards; k++)
+        {
+            bool valid = read_header(files[k], names[k], headers[k]);
+            plans[k].clear();
+            if (valid and (names[k] == "plan") and (headers[k].size() == 3))
+            {
+                plans[k] = headers[k];
+                searched = true;
+                valid = read_header(files[k], names[k], headers[k]);
+            }
+            if (!valid)
+            {
+                error = INVALID_SHARD + paths[k];
+                return false;
+            }
+        }
+
+        // Blocks of all the shards, by candidate of depth 0
+        OutputSink total;
+        reset_sink(total, limits);
+        total.callback = nullptr;
+        total.stream = &out;
+        while (true)
+        {
+            int next(-1);
+            for (size_t k(0); k < nb_shards; k++)
+            {
+                if ((names[k] == "block") and (headers[k].size() == 3) and
+                    ((next < 0) or (headers[k][0] < headers[next][0])))
+                {
+                    next = k;
+                }
+            }
+            if (next < 0)
+            {
+                break;
+            }
+            // The anagrams of a block are whole lines: a damaged one is never merged
+            if (!read_payload(files[next], headers[next][2], block) or (!block.empty() and (block.back() != '\n')))
+            {
+                error = INVALID_SHARD + paths[next];
+                return false;
+            }
+            if (limits.count_only)
+            {
+                add_anagrams(total, headers[next][1]);
+            }
+            else if (!limited)
+            {
+                out << block;
+            }
+            else
+            {
+                for (size_t start(0); (start < block.size()) and !total.stopped;)
+                {
+                    size_t end = block.find('\n', start) + 1;
+                    line.assign(block, start, end - start);
+                    emit_anagram(total, nullptr, line);
+                    start = end;
+                }
+            }
+            if (!read_header(files[next], names[next], headers[next]))
+            {
+                error = INVALID_SHARD + paths[next];
+                return false;
+            }
+        }
+
+        // How the search ended
+        bool found(false), truncated(false);
+        unsigned long long status(0), count(0);
+        for (size_t k(0); k < nb_shards; k++)
+        {
+            if ((names[k] != "end") or (headers[k].size() != 3) or
+                !read_payload(files[k], headers[k][2], k == 0 ? text : other))
+            {
+                error = INVALID_SHARD + paths[k];
+                return false;
+            }
+            if (k == 0)
+            {
+                status = headers[k][0];
+                count = headers[k][1];
+            }
+            else if ((other != text) or ((headers[k][0] == 0) != (status == 0)))
+            {
+                error = SHARDS_MISMATCH;
+                return false;
+            }
+            found = found or (headers[k][0] == (int)GranmaStatus::FOUND + 1);
+            truncated = truncated or (headers[k][0] == (int)GranmaStatus::TRUNCATED + 1);
+        }
+        out << text;
+        if (status != 0)
+        {
+            GranmaStatus merged = truncated ? GranmaStatus::TRUNCATED
+                                  : found   ? GranmaStatus::FOUND
+                                            : (GranmaStatus)(status - 1);
+            out << status_lines(merged, limits, searched ? total.count : count);
+        }
+        out.flush();
+
+        // Statistics of the shards
+        unsigned long long nodes(0), hits(0), misses(0);
+        ostringstream lines;
+        for (size_t k(0); k < nb_shards; k++)
+        {
+            if (!read_header(files[k], name, fields) or (name != "stats") or (fields.size() != 4))
+            {
+                error = INVALID_SHARD + paths[k];
+                return false;
+            }
+            nodes += fields[0];
+            hits += fields[1];
+            misses += fields[2];
+            if (!plans[k].empty())
+            {
+                lines << "shard " << shard_of[k] << '/' << nb_shards << ": " << plans[k][1] << " of " << plans[k][0]
+                      << " candidates, " << plans[k][2] / 10000 << '.' << plans[k][2] / 1000 % 10
+                      << "% of the estimated cost, " << fields[0] << " nodes, " << fields[3] / 1000 << " ms\n";
+            }
+        }
+        if (stats != nullptr)
+        {
+            *stats << "nodes: " << nodes << ", memo hits: " << hits << ", memo misses: " << misses << '\n'
+                   << lines.str() << flush;
+        }
+    }
+    return true;
+}
+
+// Reads the header line of the next record of a shard file: its name and its numbers
+// Returns false if the file ends or the line is not a header
+bool read_header(istream& file, string& name, vector<unsigned long long>& fields)
+{
+    string line;
+    if (!getline(file, line))
+    {
+        return false;
+    }
+    istringstream stream(line);
+    stream >> name;
+    fields.clear();
+    unsigned long long value;
+    while (stream >> value)
+    {
+        fields.push_back(value);
+    }
+    return !name.empty() and stream.eof();
+}
+
+// Reads the payload of a record (size bytes) into payload
+// Returns false if the file ends first
+bool read_payload(istream& file, size_t size, string& payload)
+{
+    payload.resize(size);
+    return static_cast<bool>(file.read(&payload[0], size));
+}
+
+} // namespace granma
@@ -0,0 +1,604 @@
+// Same-Granma-internal.h
+// Guillaume-Gentil Robin
+// Internals of the anagram search engine (Same-Granma.cc), shared with the program
+// (Same-Granma-CLI.cc, Same-Granma-Tools.cc); another program only needs Same-Granma.h
+// See LICENSE AND COPYRIGHT in Same-Granma.cc.
+
+#ifndef SAME_GRANMA_INTERNAL_H
+#define SAME_GRANMA_INTERNAL_H
+
+#include "Same-Granma.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#if defined(_WIN32)
+#define NO_MMAP // The index file is read into memory instead of being mapped
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace granma
+{
+
+// Error message constants
+const string NOT_IN_CAPITAL_LETTERS("The word is not purely in capital letters");
+const string DOUBLE_WORD("Each word can be present only once");
+const string EMPTY_DICT("The dictionary cannot be empty");
+const string NO_ANAGRAM("There is no anagram for this message and this dictionary");
+const string SEARCH_TRUNCATED("Search truncated: the time or node limit of the message was reached");
+const string TOO_MANY_LETTERS("A letter cannot appear more than 255 times in a message");
+const string TOO_MANY_ANAGRAMS("more than ");
+const string INVALID_INDEX("Invalid or corrupted index file: ");
+const string INVALID_SETTINGS("Invalid engine settings");
+
+// Letter-count vectors: one byte counter per letter, padded to the width of a SIMD register
+const int NB_LETTERS(26);
+const int COUNTS_WIDTH(32);
+const int MAX_LETTER_COUNT(255);
+const int MAX_MESSAGE_LETTERS(NB_LETTERS * MAX_LETTER_COUNT); // Longest message (so also most words)
+
+// Histogram of the letters of a word or of the remaining letters of a message
+// count[0] = number of 'A', ..., count[25] = number of 'Z'
+// count[26] is set to 1 when a letter appears more than MAX_LETTER_COUNT times,
+// which makes such a word impossible to fit in any message (the other lanes stay at 0)
+struct LetterCounts
+{
+    unsigned char count[COUNTS_WIDTH];
+};
+
+// Dictionary being built, with the properties of its words for search optimization
+// Struct of arrays: the letters of all the words in one pool, then one entry per word in
+// each property array, so reading, sorting and scanning the words allocates nothing per
+// word and each pass streams through one array.
+// The sorted letters (alpha) of a word are not stored: they are its letter counts read
+// from A to Z (see compare_letters).
+struct Dictionary
+{
+    vector<char> pool;           // Letters of all the words, one after the other
+    vector<uint32_t> offsets;    // Word i is pool[offsets[i]] to pool[offsets[i + 1]] (empty if no word)
+    vector<uint32_t> nbT;        // Total number of letters (Total)
+    vector<uint8_t> nbD;         // Number of distinct letters (Different)
+    vector<uint32_t> masks;      // Letters present in the word (bit l for letter 'A' + l)
+    vector<LetterCounts> counts; // Number of occurrences of each letter
+
+    size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+};
+
+// Anagram class: the words of the dictionary that have the same letters (same alpha)
+// They are contiguous in the sorted dictionary, so a class is a range of indices
+struct AnagramClass
+{
+    LetterCounts counts; // Letter counts shared by all words of the class
+    int first;           // Index of the first word of the class in the dictionary
+    int size;            // Number of words in the class
+};
+
+// Read-only array of anagram classes (in memory or in a mapped index file)
+// The letter masks are kept apart from the classes so that rejecting a class for a
+// missing letter reads 4 bytes instead of its whole AnagramClass (see keep_fitting)
+struct ClassTable
+{
+    const AnagramClass* data; // First class
+    const uint32_t* masks;    // Letters present in each class (bit l for letter 'A' + l)
+    size_t count;             // Number of classes
+
+    const AnagramClass& operator[](size_t i) const { return data[i]; }
+    size_t size() const { return count; }
+};
+
+// Node of the letter-count trie over the alpha keys of the anagram classes
+// The edge to a node means "take copies copies of letter"; the letters increase along a
+// path, so a path spells an alpha key (AAB = 2 x A, then 1 x B). The children of a node
+// are contiguous, sorted by letter then by number of copies, and node 0 is the root.
+// No padding: nodes are stored as they are in index files.
+struct TrieNode
+{
+    uint16_t letter;      // Letter of the edge from the parent
+    uint16_t copies;      // Copies of the letter taken by that edge
+    int key_class;        // Class whose letters end at this node (-1 if none)
+    uint32_t first_child; // The children are the nodes first_child to end_child - 1
+    uint32_t end_child;
+};
+
+// Searchable dictionary: the sorted words and their anagram classes, in flat arrays
+// Built from the words of the dictionary, or mapped from a file written by
+// --build-index, in which case nothing is parsed or sorted at startup
+struct SearchIndex
+{
+    const char* pool;          // Letters of all the words, in dictionary order
+    const uint32_t* offsets;   // Word i is pool[offsets[i]] to pool[offsets[i + 1]] (nb_words + 1 entries)
+    size_t nb_words;           // Number of words
+    ClassTable classes;        // Anagram classes (combination search)
+    ClassTable words;          // One class per word (other searches)
+    const TrieNode* trie;      // Letter-count trie over the keys of the anagram classes
+    size_t nb_nodes;           // Number of trie nodes
+    vector<char> pool_data;    // Storage of the arrays when the index is built in memory
+    vector<uint32_t> offset_data;
+    vector<AnagramClass> class_data;
+    vector<AnagramClass> word_data;
+    vector<uint32_t> class_mask_data;
+    vector<uint32_t> word_mask_data;
+    vector<TrieNode> trie_data;
+    vector<uint64_t> file_data; // Contents of the index file when it cannot be mapped
+    void* mapping;             // Mapped index file (nullptr if none)
+    size_t mapping_size;       // Size of the mapping
+};
+
+// Header of an index file, followed by the arrays of the SearchIndex
+// Each array starts at a multiple of 8 bytes; offsets are counted from the start of the file.
+// The arrays are stored as they are in memory: an index file is only valid on the kind
+// of machine that wrote it (the version and class size are checked when it is loaded).
+struct IndexHeader
+{
+    char magic[8];           // INDEX_MAGIC
+    uint32_t version;        // INDEX_VERSION
+    uint32_t class_size;     // sizeof(AnagramClass)
+    uint64_t file_size;      // Size of the whole file
+    uint64_t checksum;       // Checksum of everything after the header
+    uint64_t nb_words;       // Number of words
+    uint64_t nb_classes;     // Number of anagram classes
+    uint64_t pool_offset;    // Letters of the words
+    uint64_t pool_size;
+    uint64_t offsets_offset; // Start of each word in the pool (nb_words + 1 entries)
+    uint64_t classes_offset; // Anagram classes (nb_classes entries)
+    uint64_t words_offset;   // One class per word (nb_words entries)
+    uint64_t class_masks_offset; // Letter mask of each anagram class (nb_classes entries)
+    uint64_t word_masks_offset;  // Letter mask of each word (nb_words entries)
+    uint64_t trie_offset;    // Letter-count trie (nb_nodes entries)
+    uint64_t nb_nodes;
+};
+
+// Identification of index files; the version changes with the layout of the file
+const char INDEX_MAGIC[8] = {'G', 'R', 'A', 'N', 'M', 'A', 'I', 'X'};
+const uint32_t INDEX_VERSION(3);
+
+// Options of the searches, made from the settings of an engine (see configure)
+struct Options
+{
+    bool recursive;    // Use the original recursive search instead of the stack-based engine
+    bool combinations; // Find each set of words once instead of once per word order
+    bool permutations; // Print every word order of each set found in combination mode
+    bool fewest_words; // Search the anagrams of 1 word, then of 2 words... (printed in that order)
+    long long memo_mb; // Size of the table of known search states, in megabytes (0 = none)
+    long long cache_mb; // Size of the cache of anagrams of known states, in megabytes (0 = none)
+    long long threads; // Number of threads searching each message
+    bool count_only;    // Print the number of anagrams of each message instead of the anagrams
+    bool totals;        // Compute the numbers of anagrams of each message without listing them
+    long long first;    // Stop each message after this number of anagrams (0 = no limit)
+    long long max_bytes; // Stop each message before its anagrams exceed this size (0 = no limit)
+    long long shard_index; // Search only this shard of the candidates of depth 0 (from 1)
+    long long shard_count; // Number of shards of the search (0 = not sharded)
+    ostream* shard_output; // Stream of the shard file during the search (nullptr if not sharded)
+    long long max_words;  // Anagrams have at most this number of words (0 = no limit)
+    long long min_words;  // Anagrams have at least this number of words (0 = no limit)
+    long long min_length; // Only words of at least this number of letters are searched (0 = no limit)
+    long long time_limit; // Stop the search of each message after this many milliseconds (0 = no limit)
+    long long node_limit; // Stop the search of each message after this many nodes (0 = no limit)
+    vector<string> required; // Words that every anagram contains (printed first)
+    vector<string> excluded; // Words that no anagram contains
+
+    // Constraints on words, resolved once the dictionary is known (see resolve_constraints)
+    vector<int> required_words;   // Dictionary indices of the required words
+    LetterCounts required_counts; // Letters of the required words
+    string prefix;                // Required words, printed at the start of each anagram
+    vector<char> banned;          // banned[i]: word i is required or excluded, so never searched (empty if none)
+    bool unusable;                // A required word is not in the dictionary, is excluded or is repeated
+};
+
+// One depth of the explicit search stack
+struct SearchFrame
+{
+    LetterCounts remaining; // Message letters still to place at this depth
+    size_t first;           // Start of this depth's candidate list in the arena
+    size_t end;             // End of this depth's candidate list in the arena
+    size_t next;            // Next candidate to try
+    size_t stop;            // End of the candidates to try (list or pivot posting list)
+    int pivot;              // Letter that the words tried at this depth must contain (combination mode)
+    int chosen;             // Class currently chosen at this depth
+    int uses;               // Number of words of the chosen class used up to this depth
+    int key_class;          // State key besides the remaining letters: class the pivot words
+    int key_detail;         // continue from and its uses and the pivot (-1 at the start of a pivot)
+    bool found;             // At least one anagram was found below this depth
+    bool memo;              // The result of this depth can be stored in the memo table
+    bool recording;         // The anagrams found below this depth are logged to be cached
+    size_t log_start;       // Start of this depth's anagrams in the log
+};
+
+// Entry of the transposition table: a search state whose anagrams are known
+struct MemoEntry
+{
+    LetterCounts remaining; // Remaining letters of the state
+    int key_class;          // Rest of the key (see SearchFrame)
+    int key_detail;
+    int first_solution;     // Start of the cached anagrams in the solution pool (-1 = empty entry)
+    int solution_size;      // Size of the cached anagrams in the pool (0 = dead end)
+};
+
+// Transposition table shared by all messages
+// The same remaining letters are reached by many paths (A then B, B then A...): the
+// table remembers the states that have no anagram and, if a cache size is given,
+// the anagrams of small subtrees. Buckets of MEMO_WAYS entries, replaced in turn.
+struct MemoTable
+{
+    vector<MemoEntry> entries; // Number of entries = power of 2
+    vector<int> solutions;     // Cached anagrams: classes from the state's depth, ended by -1
+    size_t max_solutions;      // Capacity of the solution pool
+    unsigned replace;          // Next way replaced in a full bucket
+    long long hits;            // Lookups that ended a branch (during the last search)
+    long long misses;          // Lookups that did not (during the last search)
+};
+
+// Destination of the anagrams of a message: counts them and stops the search as soon
+// as a limit of the options is reached (--count, --first, --max-bytes)
+struct OutputSink
+{
+    bool count_only;          // Count the anagrams without printing them
+    long long first;          // Stop after this number of anagrams (0 = no limit)
+    long long max_bytes;      // Stop before the anagrams printed exceed this size (0 = no limit)
+    unsigned long long count; // Anagrams of the message so far
+    unsigned long long bytes; // Size of the anagrams printed so far
+    bool stopped;             // A limit was reached: the search stops
+    bool truncated;           // The limit was the time or node limit: the search did not end
+    const AnagramSink* callback; // Receives the anagrams instead of the output (nullptr if none)
+    ostream* stream;          // Where the anagrams are printed when there is no output buffer
+};
+
+// Number of anagrams counted by the counting engine (128 bits where the compiler has them)
+#if defined(__SIZEOF_INT128__)
+typedef unsigned __int128 AnagramCount;
+#else
+typedef unsigned long long AnagramCount;
+#endif
+
+// State of the counting engine: the remaining letters and, inside a pivot group, the
+// pivot letter and the first class that can still be chosen (-1 and -1 between groups)
+struct CountKey
+{
+    LetterCounts remaining;
+    int pivot;
+    int min_class;
+};
+
+struct CountKeyHash
+{
+    size_t operator()(const CountKey& key) const;
+};
+
+struct CountKeyEqual
+{
+    bool operator()(const CountKey& a, const CountKey& b) const;
+};
+
+// Memo of the counting engine: for each state, the number of ways to finish it with
+// n words, for each n
+struct CountTable
+{
+    unordered_map<CountKey, vector<AnagramCount>, CountKeyHash, CountKeyEqual> states;
+    bool overflow; // A count did not fit in an AnagramCount
+    vector<AnagramCount> none; // Count of the states reached after a time or node limit (empty)
+};
+
+struct Scheduler;
+struct OutputChunk;
+
+// Memory reused by the stack-based search from one message to the next
+// Sized once per message from its number of letters, so the search loop never allocates
+// In a parallel search each worker has its own arena (and memo table)
+struct SearchArena
+{
+    vector<SearchFrame> frames; // One frame per depth (a word has at least one letter)
+    vector<int> candidates;     // Candidate lists of all depths, stacked one after the other
+    vector<int> chosen;         // Classes of the anagram being printed, one per word
+    vector<int> anagram;        // Dictionary indices of the anagram being printed
+    string line;                // Output buffer for the anagram being printed
+    long long nodes;            // Number of words placed during the last search
+    MemoTable memo;             // Known states (kept from one message to the next)
+    vector<int> log;            // Anagrams found while some depth is recording
+    vector<int> by_length;      // Words of the depth being prepared, by number of letters
+    vector<uint64_t> reach;     // Numbers of letters that these words can add up to (bitset)
+    int recorders;              // Number of recording depths on the stack
+    string* output;             // Where anagrams are printed (the stream of the sink if nullptr)
+    ostream* stats;             // Where the statistics of each search are printed (nullptr = nowhere)
+    OutputSink sink;            // Count and limits of the anagrams printed
+    Scheduler* scheduler;       // Parallel search this arena works for (nullptr if sequential)
+    int worker;                 // Number of the worker using this arena in a parallel search
+    OutputChunk* chunk;         // Output chunk of the task being searched by the worker
+    chrono::steady_clock::time_point deadline; // End of the time allowed to the message (--time-limit)
+    long long next_check;       // Node count at which the time and node limits are checked next
+    long long next_split;       // Node count at which the worker next looks for idle workers
+};
+
+// Part of the output of a parallel search: the anagrams of one task, in search order
+// Chunks form a list in the order of the sequential search
+struct OutputChunk
+{
+    string text;       // Anagrams printed by the task
+    unsigned long long count; // Number of anagrams of the task (printed or only counted)
+    int position;      // Candidate of depth 0 the task is below (rank in search order)
+    bool stopped;      // The task reached an output limit on its own
+    bool truncated;    // The task ran out of time or nodes (see check_limits)
+    OutputChunk* next; // Chunk printed after this one (nullptr for the last one)
+    bool done;         // The task is finished (guarded by Scheduler::lock)
+};
+
+// Subtree given to a worker: the candidates still to try at one depth of the search
+struct SearchTask
+{
+    vector<SearchFrame> path; // Frames of the depths above (chosen classes and their uses)
+    SearchFrame frame;        // Frame of the task's depth
+    vector<int> list;         // Candidate list of the depth, followed by the candidates to try
+    OutputChunk* chunk;       // Where the task prints its anagrams
+};
+
+// Task deque of a worker: the worker takes its newest tasks, thieves its oldest ones
+struct WorkerQueue
+{
+    mutex lock;
+    deque<SearchTask*> tasks;
+};
+
+// Work-stealing scheduler of a parallel search
+struct Scheduler
+{
+    vector<WorkerQueue> queues; // One deque per worker
+    atomic<int> idle;           // Number of workers looking for a task
+    atomic<int> pending;        // Number of tasks not finished yet
+    atomic<int> queued;         // Number of tasks waiting in the deques
+    atomic<bool> found;         // At least one anagram was found
+    atomic<bool> stop;          // The output of the message reached a limit: the workers stop
+    atomic<long long> nodes;    // Nodes granted to the workers, at most --node-limit (see check_limits)
+    atomic<bool> truncated;     // The time or node limit was reached
+    mutex lock;                 // Guards the done flags of the output chunks
+    condition_variable ready;   // Signaled when a chunk is done
+    condition_variable work;    // Signaled when a task is queued or the last task is finished
+};
+
+// Number of entries per bucket of the memo table
+const int MEMO_WAYS(4);
+
+// A worker of a parallel search checks for idle workers every SPLIT_INTERVAL nodes, and
+// every search checks its time limit as often (and its node limit when it is reached)
+const long long SPLIT_INTERVAL(256);
+
+// A sharded search estimates the cost of each candidate of depth 0 on at most
+// SHARD_SAMPLE of the candidates, and starts each shard file with SHARD_MAGIC
+const size_t SHARD_SAMPLE(256);
+const string SHARD_MAGIC("granma-shard");
+
+// === FUNCTION PROTOTYPES ===
+
+// Dictionary creation and validation
+bool create_dictionary(const WordSource& source, Dictionary& dict); // Reads the words of the dictionary
+GranmaStatus check_dictionary(const Dictionary& dict, bool capitals); // Checks the sorted dictionary
+bool is_capital_letter(const string& element);                           // Checks if all characters are uppercase
+void add_word(Dictionary& dict, const char* letters, size_t size);       // Appends a word to the pool
+
+// Dictionary conversion and preparation
+void convert(Dictionary& dict);                    // Calculates the properties of the words of the pool
+int count_distinct_letters(const string& element); // Calculates the number of distinct letters in a word
+string sort_letters(const string& element);        // Sorts the letters of a word alphabetically
+vector<AnagramClass> create_classes(const Dictionary& dict, bool group_anagrams); // Groups the sorted words by alpha
+int compare_letters(const Dictionary& dict, size_t a, size_t b); // Compares the alpha of two words
+int compare_words(const Dictionary& dict, size_t a, size_t b);   // Compares two words alphabetically
+
+// Dictionary index (flat arrays, optionally stored in a file)
+void create_index(Dictionary& dict, SearchIndex& index);          // Builds the index of the sorted dictionary
+bool write_index(const SearchIndex& index, const string& path);   // Writes the index to a file
+bool map_index(const string& path, SearchIndex& index);           // Maps an index file and checks it
+void release_index(SearchIndex& index);                           // Unmaps the index file
+uint64_t index_checksum(const char* data, size_t size);           // Checksum of the body of an index file
+void append_word(string& text, const SearchIndex& index, int i);  // Appends the i-th word to the text
+vector<TrieNode> create_trie(const ClassTable& classes);          // Builds the letter-count trie of the classes
+void walk_trie(const SearchIndex& index, const LetterCounts& remaining, vector<int>& found, vector<uint32_t>& stack);
+// Appends the classes whose letters all fit in the remaining letters (in trie order)
+int find_class(const SearchIndex& index, const LetterCounts& counts);
+// Returns the class whose letters are exactly the given ones (-1 if none)
+
+// Dictionary sorting (hierarchical sorting on 4 levels)
+void sort_dictionary(Dictionary& dict); // Sorts by total letters, distinct letters, sorted letters, then word
+
+// Message management
+void display_dictionary(const SearchIndex& index, ostream& out); // Displays all words in the dictionary
+bool is_all_uppercase(const string& message, SearchArena& arena, string& letters); // Checks the words of the message
+void write_text(SearchArena& arena, const string& text);                // Prints text where the arena prints its anagrams
+void write_output(const OutputSink& sink, string* output, const string& text); // Prints into a buffer or the stream
+
+// Output sink (anagram counts and output limits)
+void reset_sink(OutputSink& sink, const Options& options);                         // Starts the count of a message
+void emit_anagram(OutputSink& sink, string* output, const string& line);           // Prints an anagram within the limits
+void add_anagrams(OutputSink& sink, unsigned long long count);                     // Counts anagrams without printing them
+bool check_limits(const Options& options, SearchArena& arena);                     // Stops a search past its time or node limit
+void return_nodes(const Options& options, SearchArena& arena);                     // Gives back the unused nodes of a worker
+unsigned long long count_choices(const ClassTable& classes, const int* chosen, int nb_words, bool permutations);
+// Number of lines printed for the classes of an anagram
+
+// Letter-count vectors (vectorized with AVX2 or SSE2 when available)
+LetterCounts count_letters(const string& element);                       // Builds the letter-count vector of a word or message
+bool counts_contain(const LetterCounts& message, const LetterCounts& word); // Checks that every letter count of the word fits
+void subtract_counts(LetterCounts& message, const LetterCounts& word);      // Subtracts the letter counts of the word
+bool counts_empty(const LetterCounts& message);                            // Checks that no letter remains
+uint32_t letter_mask(const LetterCounts& counts);                          // Letters present (bit l for letter 'A' + l)
+size_t keep_fitting(const ClassTable& classes, const int* list, size_t count, const LetterCounts& remaining,
+                    int skip, int* kept);                                  // Keeps the classes that fit in the letters
+size_t keep_last_word(const SearchIndex& index, const ClassTable& classes, const int* list, size_t count,
+                      const LetterCounts& remaining, int skip, int* kept); // Keeps the classes made of the letters
+void add_presence(LetterCounts& total, const LetterCounts& word);          // Counts the word in the lanes of its letters
+int count_total(const LetterCounts& counts);                               // Total number of letters
+
+// Letter manipulation for search
+bool message_contains_word(const LetterCounts& alpha_m, const Dictionary& dict, int i);       // Checks if the message contains all letters of a word
+LetterCounts subtract_word_from_message(LetterCounts alpha_m, const Dictionary& dict, int i); // Removes the letters of a word from the message
+
+// Options
+Options default_options();                                     // Options of the engine without settings
+void resolve_constraints(const SearchIndex& index, Options& options); // Finds the required and excluded words
+int find_word(const SearchIndex& index, const string& element);      // Index of a word of the dictionary (-1 if none)
+
+// Anagram search algorithm (recursive backtracking)
+bool search_anagram(const Dictionary& dict, vector<int> usable, LetterCounts alpha_m, vector<int> anagram,
+                    const Options& options, SearchArena& arena);
+// Recursive function that finds all possible anagrams (original version, see --recursive)
+
+bool search_anagram_stack(const ClassTable& classes, const vector<int>& candidates, const LetterCounts& alpha_m,
+                          size_t max_words, const Options& options, SearchArena& arena, const SearchIndex& index);
+// Same search with an explicit stack over class indices, without copies
+
+bool start_search(const ClassTable& classes, const vector<int>& candidates, const LetterCounts& alpha_m,
+                  size_t max_words, const Options& options, SearchArena& arena);
+// Prepares the arena and the first depth of a search
+
+void run_search(const ClassTable& classes, const Options& options, SearchArena& arena, const SearchIndex& index,
+                int base);
+// Runs the search loop from the top frame down to depth base
+
+bool prepare_frame(SearchFrame& frame, int* list, const ClassTable& classes, int pivot, int min_class,
+                   int nb_words, const Options& options, SearchArena& arena);
+// Checks a new depth and builds the posting list of its pivot letter
+
+bool words_within_limits(const vector<int>& by_length, int total, int nb_words, const Options& options);
+// Checks that the words of a depth can finish an anagram within the word-count limits
+
+bool length_reachable(const vector<int>& by_length, int total, vector<uint64_t>& reach);
+// Checks that words of the given lengths can add up to exactly total letters
+
+int choose_pivot(const LetterCounts& remaining, const LetterCounts& presence);
+// Returns the remaining letter contained in the fewest candidates (-1 if one is in none)
+
+void expand_anagram(const SearchIndex& index, const ClassTable& classes, int nb_words, const Options& options,
+                    SearchArena& arena);
+// Prints every choice of words for the classes stored in the arena
+
+// Parallel search (--threads)
+bool search_anagram_parallel(const ClassTable& classes, const vector<int>& candidates, const LetterCounts& alpha_m,
+                             size_t max_words, const Options& options, vector<SearchArena>& arenas,
+                             const SearchIndex& index);
+// Splits the search into tasks run by several threads, printed in sequential order
+
+void run_worker(const ClassTable& classes, const Options& options, SearchArena& arena, const SearchIndex& index);
+// Runs tasks until the whole search is done
+
+SearchTask* take_task(Scheduler& scheduler, int worker); // Takes a task of the worker or steals one
+void split_search(SearchArena& arena, int depth, int base); // Gives the remaining candidates of a depth to idle workers
+OutputChunk* insert_chunk(OutputChunk* previous);           // Adds an output chunk after another one
+vector<uint64_t> estimate_costs(const ClassTable& classes, const SearchArena& arena); // Cost of each candidate of depth 0
+vector<int> assign_shards(const vector<uint64_t>& costs, int nb_shards);             // Balances them over the shards
+
+// Transposition table (memo of known search states)
+void init_memo(MemoTable& memo, const Options& options, SearchArena& arena); // Allocates the table
+uint64_t hash_state(const LetterCounts& remaining, int key_class, int key_detail); // Hashes a state key
+const MemoEntry* find_memo(MemoTable& memo, const SearchFrame& frame);          // Looks a state up
+void store_memo(MemoTable& memo, const SearchFrame& frame, int depth, SearchArena& arena); // Stores a state
+bool is_clean(const SearchFrame* frames, int depth, const ClassTable& classes); // Checks the state is memoizable
+void log_anagram(SearchArena& arena, int nb_words);                     // Logs an anagram for recording depths
+
+void print_anagram(const SearchIndex& index, int nb_words, const Options& options, SearchArena& arena);
+// Prints the anagram stored in the arena (all its word orders with --permutations)
+
+// Counting engine (--totals)
+GranmaStatus count_totals(const ClassTable& classes, const vector<int>& candidates, const LetterCounts& alpha_m,
+                          const Options& options, SearchArena& arena);
+// Prints the numbers of anagrams of a message, in word orders and in sets of words
+
+const vector<AnagramCount>& count_state(const ClassTable& classes, const vector<int>& candidates, CountKey key,
+                                        CountTable& table, const Options& options, SearchArena& arena);
+// Number of ways to finish a state, by number of words (memoized)
+
+AnagramCount add_count(AnagramCount a, AnagramCount b, bool& overflow);      // Sum that saturates on overflow
+AnagramCount multiply_count(AnagramCount a, AnagramCount b, bool& overflow); // Product that saturates on overflow
+string count_to_string(AnagramCount value, bool overflow);                   // Decimal text of a count
+
+void prepare_arena(SearchArena& arena, size_t nb_candidates, size_t max_words);
+// Sizes the search arena for a message
+
+GranmaStatus write_required_only(const Options& options, SearchArena& arena);
+// Prints the anagram made of the required words alone
+
+GranmaStatus find_anagrams(const string& message, const SearchIndex& index, const ClassTable& classes,
+                           const Options& options, vector<SearchArena>& arenas);
+// Initializes and launches the anagram search for a message, returns how it ended
+
+bool run_engine(const SearchIndex& index, const ClassTable& classes, const vector<int>& candidates,
+                const LetterCounts& alpha_m, size_t max_words, const Options& options, vector<SearchArena>& arenas);
+// Searches the candidates with the engine chosen by the options
+
+bool search_by_word_count(const SearchIndex& index, const ClassTable& classes, const vector<int>& candidates,
+                          const LetterCounts& alpha_m, size_t max_words, const Options& options,
+                          vector<SearchArena>& arenas);
+// Searches the anagrams of each number of words in turn (--fewest-words)
+
+GranmaStatus process_message(const string& message, const SearchIndex& index, const ClassTable& classes,
+                             const Options& options, vector<SearchArena>& arenas);
+// Checks a message and prints its anagrams, then how the search ended
+
+string status_lines(GranmaStatus status, const Options& options, unsigned long long count);
+// Lines printed after the anagrams of a message: how the search ended, or the count
+
+const ClassTable& select_classes(const SearchIndex& index, const Options& options);
+// Chooses the class table searched: anagram classes or one class per word
+
+// Timing
+double elapsed_ms(chrono::steady_clock::time_point start); // Milliseconds since start
+
+// Sharded search (--shard), see AnagramEngine::write_shard
+void write_record(ostream& file, const string& header, const string& payload); // Header line, then payload
+
+// Tools of the program (Same-Granma-Tools.cc)
+GranmaStatus run_benchmark(const EngineSettings& settings, long long max_words, long long seed,
+                           long long solvable, ostream& out);
+// Times the phases of the program on generated dictionaries of up to max_words words and
+// prints the results in JSON (--benchmark); returns INVALID_SETTINGS, the status of a
+// generated dictionary that is not valid, or FOUND
+
+bool merge_shards(const vector<string>& paths, ostream& out, ostream* stats, string& error);
+// Prints the output of a sharded search from the files of all its shards, and their
+// statistics to stats if it is not nullptr (--merge); returns false, with the message in
+// error, if the files are not the shards of one search
+
+vector<int> adapt_dictionary(const SearchIndex& index, const ClassTable& classes, const LetterCounts& alpha_m,
+                             const Options& options, size_t& max_words);
+// Optimizes the dictionary by keeping the indices of the classes that can be used
+
+vector<int> remove_word(vector<int> usable, int i);
+// Removes the i-th word from the usable words
+
+// Engine (library interface, at the end of the file)
+Options settings_options(const EngineSettings& settings); // Options of the searches for the settings
+bool valid_options(const Options& options);               // Checks the options as the command line does
+vector<SearchArena> take_arenas(EngineState& state, ostream* out, ostream* stats); // Arenas of a search
+void return_arenas(EngineState& state, vector<SearchArena>& arenas);              // Keeps them for the next
+GranmaStatus search_engine(EngineState& state, const string& message, ostream* out, string* output,
+                           const AnagramSink* sink, ostream* stats);
+// Searches a message of an engine and prints it as the program does
+
+} // namespace granma
+
+#endif
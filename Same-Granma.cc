@@ -1,623 +1,3150 @@
-// Same-Granma.cc
-// Guillaume-Gentil Robin
-// version 4.1 - English Version
-//
-// ============================================================================
-// LICENSE AND COPYRIGHT
-// ============================================================================
-// Copyright (c) 2022 Guillaume-Gentil Robin
-//
-// This code is distributed under an open source license.
-//
-// You are free to:
-//   - Use this code for personal or commercial purposes
-//   - Modify and adapt this code to your needs
-//   - Distribute this code or modified versions
-//
-// Conditions:
-//   - Attribution is required: you must credit the original author
-//     (Guillaume-Gentil Robin) in any use or redistribution
-//   - This code is provided "as is", without warranty of any kind
-//
-// For questions or specific permission requests:
-//   Contact: robin_gg@icloud.com
-// ============================================================================
-
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <sstream>
-#include <vector>
-
-using namespace std;
-
-// Error message constants
-const string NOT_IN_CAPITAL_LETTERS("The word is not purely in capital letters");
-const string DOUBLE_WORD("Each word can be present only once");
-const string EMPTY_DICT("The dictionary cannot be empty");
-const string NO_ANAGRAM("There is no anagram for this message and this dictionary");
-
-// Structure representing a word with its properties for search optimization
-struct Word
-{
-    string word;  // The original word
-    int nbT;      // Total number of letters (Total)
-    int nbD;      // Number of distinct letters (Different)
-    string alpha; // Letters of the word sorted alphabetically (e.g., "CAB" -> "ABC")
-};
-
-typedef vector<Word> Dictionary;
-
-// === FUNCTION PROTOTYPES ===
-
-// Dictionary creation and validation
-vector<string> create_dictionary();                          // Reads and validates the dictionary from standard input
-bool is_capital_letter(string element);                      // Checks if all characters are uppercase
-bool is_duplicate_word(string element, vector<string> list); // Checks if a word is not already present
-
-// Dictionary conversion and preparation
-vector<Word> convert(vector<string> list);  // Transforms a list of strings into a dictionary of Word structures
-int count_distinct_letters(string element); // Calculates the number of distinct letters in a word
-string sort_letters(string element);        // Sorts the letters of a word alphabetically
-
-// Dictionary sorting functions (hierarchical sorting on 4 levels)
-vector<Word> sort_by_total(vector<Word> dict);       // Sort by total number of letters
-vector<Word> sort_by_distinct(vector<Word> dict);    // Sort by number of distinct letters
-vector<Word> sort_by_alpha(vector<Word> dict);       // Sort by sorted letters order
-vector<Word> sort_alphabetically(vector<Word> dict); // Alphabetical sort of the original word
-
-// Message management
-vector<vector<string>> create_messages();      // Reads messages to analyze from standard input
-void display_dictionary(vector<Word> dict);    // Displays all words in the dictionary
-bool is_all_uppercase(vector<string> message); // Checks that all words in the message are uppercase
-
-// Letter manipulation for search
-string sort_message_letters(string message);                   // Sorts the letters of a message alphabetically
-bool message_contains_word(string alpha, Word element);        // Checks if the message contains all letters of a word
-string subtract_word_from_message(string alpha, Word element); // Removes the letters of a word from the message
-
-// Anagram search algorithm (recursive backtracking)
-bool search_anagram(vector<Word> dict, string alpha_m, vector<string> anagram);
-// Recursive function that finds all possible anagrams
-
-void find_anagrams(string message, vector<Word> dict);
-// Initializes and launches the anagram search for a message
-
-vector<Word> adapt_dictionary(vector<Word> dict, string alpha);
-// Optimizes the dictionary by removing impossible-to-use words
-
-vector<Word> remove_word(vector<Word> dict, int i);
-// Removes the i-th word from the dictionary
-
-int main()
-{
-    // Step 1: Dictionary creation
-    vector<string> raw_list;
-    raw_list = create_dictionary(); // Reading and validation of words
-
-    // Step 2: Conversion and sorting of the dictionary
-    Dictionary dict;
-    dict = convert(raw_list);         // Calculation of properties (nbT, nbD, alpha)
-    dict = sort_by_total(dict);       // Sort 1: by number of letters
-    dict = sort_by_distinct(dict);    // Sort 2: by distinct letters
-    dict = sort_by_alpha(dict);       // Sort 3: by sorted letters
-    dict = sort_alphabetically(dict); // Sort 4: alphabetical order
-
-    // Step 3: Reading messages to analyze
-    vector<vector<string>> message_list;
-    message_list = create_messages();
-
-    // Step 4: Display of the sorted dictionary
-    display_dictionary(dict);
-    if (!message_list.empty())
-    {
-        cout << endl; // Empty line between dictionary and results
-    }
-
-    // Step 5: Processing each message
-    string message;
-    for (size_t j(0); j < message_list.size(); j++)
-    {
-        if (is_all_uppercase(message_list[j]))
-        { // Check that the message is uppercase
-            // Concatenation of all words of the message into a single string
-            for (auto element : message_list[j])
-            {
-                for (auto letter : element)
-                {
-                    message.push_back(letter);
-                }
-            }
-            // Search and display of anagrams
-            find_anagrams(message, dict);
-        }
-        if (j != message_list.size() - 1)
-        {
-            cout << endl; // Empty line between results of different messages
-        }
-        message.clear(); // Reset for next message
-    }
-    return 0;
-}
-
-// Reads and validates the dictionary from standard input
-// Format: uppercase words separated by spaces, terminated by "."
-// Possible errors: empty dictionary, lowercase word, duplicate word
-vector<string> create_dictionary()
-{
-    string element;
-    bool loop(true);
-    vector<string> raw_list;
-    do
-    {
-        cin >> element;
-        if (element == ".")
-        { // End of dictionary
-            if (raw_list.empty())
-            {
-                cout << EMPTY_DICT << endl;
-                exit(0);
-            }
-            else
-            {
-                loop = false; // Valid dictionary, exit loop
-            }
-        }
-        else
-        { // New word to add
-            if (is_capital_letter(element))
-            { // Check uppercase
-                if (is_duplicate_word(element, raw_list))
-                { // Check no duplicate
-                    raw_list.push_back(element);
-                }
-                else
-                {
-                    cout << DOUBLE_WORD << endl;
-                    exit(0);
-                }
-            }
-            else
-            {
-                cout << NOT_IN_CAPITAL_LETTERS << endl;
-                exit(0);
-            }
-        }
-    } while (loop);
-    return raw_list;
-}
-
-// Checks that all characters of a word are uppercase (A-Z: ASCII 65-90)
-bool is_capital_letter(string element)
-{
-    int character;
-    for (size_t i(0); i < element.size(); i++)
-    {
-        character = element[i];
-        if ((character < 65) or (character > 90))
-        { // Outside the A-Z range
-            return false;
-        }
-    }
-    return true;
-}
-
-// Checks that a word is not already present in the list (no duplicates)
-bool is_duplicate_word(string element, vector<string> list)
-{
-    for (auto word : list)
-    {
-        if (word == element)
-        {
-            return false; // Word found = duplicate
-        }
-    }
-    return true; // Word not yet in the list
-}
-
-// Converts a list of strings into a dictionary of Word structures
-// Calculates for each word: nbT, nbD, alpha
-vector<Word> convert(vector<string> list)
-{
-    Word w;
-    Dictionary dict;
-
-    for (auto element : list)
-    {
-        w.word = element;                        // Original word
-        w.nbT = element.size();                  // Total number of letters
-        w.nbD = count_distinct_letters(element); // Number of distinct letters
-        w.alpha = sort_letters(element);         // Letters sorted alphabetically
-        dict.push_back(w);
-    }
-    return dict;
-}
-
-// Calculates the number of distinct letters in a word
-// Example: "HELLO" -> 4 distinct letters (H, E, L, O)
-int count_distinct_letters(string element)
-{
-    vector<char> distinct_chars;
-    bool new_character;
-    distinct_chars.push_back(element[0]); // First letter always added
-    for (auto letter1 : element)
-    {
-        new_character = true;
-        // Check if the letter is already in the list
-        for (auto letter2 : distinct_chars)
-        {
-            if (letter1 == letter2)
-            {
-                new_character = false;
-            }
-        }
-        if (new_character)
-        {
-            distinct_chars.push_back(letter1);
-        }
-    }
-    return distinct_chars.size();
-}
-
-// Sorts the letters of a word alphabetically
-// Example: "CAB" -> "ABC", "HELLO" -> "EHLLO"
-// Uses insertion sort
-string sort_letters(string element)
-{
-    string characters;
-    characters.push_back(element[0]); // First letter
-    bool loop(true);
-    size_t j(0);
-    // For each following letter, find its position in alphabetical order
-    for (size_t i(1); i < element.size(); i++)
-    {
-        loop = true;
-        j = 0;
-        while (loop)
-        {
-            if (j >= characters.size())
-            {
-                // Larger than all existing letters: add to the end
-                characters.push_back(element[i]);
-                loop = false;
-            }
-            else
-            {
-                if (characters[j] > element[i])
-                {
-                    // Find insertion position
-                    characters.insert(j, 1, element[i]);
-                    loop = false;
-                }
-            }
-            j += 1;
-        }
-    }
-    return characters;
-}
-
-// Sort level 1: by total number of letters (ascending)
-// Uses bubble sort
-vector<Word> sort_by_total(vector<Word> dict)
-{
-    Word temp_element;
-    for (size_t j(0); j < (dict.size() - 1); j++)
-    {
-        for (size_t i(0); i < (dict.size() - 1); i++)
-        {
-            if (dict[i].nbT > dict[i + 1].nbT)
-            {
-                // Swap if current word is longer
-                temp_element = dict[i];
-                dict[i] = dict[i + 1];
-                dict[i + 1] = temp_element;
-            }
-        }
-    }
-    return dict;
-}
-
-// Sort level 2: by number of distinct letters (ascending)
-// Only sorts if nbT is identical (stable sort)
-vector<Word> sort_by_distinct(vector<Word> dict)
-{
-    Word temp_element;
-    for (size_t j(0); j < (dict.size() - 1); j++)
-    {
-        for (size_t i(0); i < (dict.size() - 1); i++)
-        {
-            if ((dict[i].nbD > dict[i + 1].nbD) and (dict[i].nbT == dict[i + 1].nbT))
-            {
-                // Swap only if same length
-                temp_element = dict[i];
-                dict[i] = dict[i + 1];
-                dict[i + 1] = temp_element;
-            }
-        }
-    }
-    return dict;
-}
-
-// Sort level 3: by sorted letters order (alpha)
-// Compares character by character the alphabetized versions
-// Only sorts if nbT and nbD are identical
-vector<Word> sort_by_alpha(vector<Word> dict)
-{
-    Word temp_element;
-    int alpha1(0);
-    int alpha2(0);
-    int h(0);
-    for (size_t j(0); j < (dict.size() - 1); j++)
-    {
-        for (size_t i(0); i < (dict.size() - 1); i++)
-        {
-            alpha1 = 0;
-            alpha2 = 0;
-            h = 0;
-            // Find the first different character
-            while (alpha1 == alpha2)
-            {
-                alpha1 = dict[i].alpha[h];
-                alpha2 = dict[i + 1].alpha[h];
-                h += 1;
-            }
-            // Swap if same nbT and nbD, but different alpha
-            if (((alpha1 > alpha2) and (dict[i].nbD == dict[i + 1].nbD)) and
-                (dict[i].nbT == dict[i + 1].nbT))
-            {
-                temp_element = dict[i];
-                dict[i] = dict[i + 1];
-                dict[i + 1] = temp_element;
-            }
-        }
-    }
-    return dict;
-}
-
-// Sort level 4: alphabetical order of the original word
-// Classic lexicographic comparison
-// Only sorts if nbT, nbD and alpha are identical
-vector<Word> sort_alphabetically(vector<Word> dict)
-{
-    Word temp_element;
-    int char1(0);
-    int char2(0);
-    int h(0);
-    for (size_t j(0); j < (dict.size() - 1); j++)
-    {
-        for (size_t i(0); i < (dict.size() - 1); i++)
-        {
-            char1 = 0;
-            char2 = 0;
-            h = 0;
-            // Find the first different character in the original words
-            while (char1 == char2)
-            {
-                char1 = dict[i].word[h];
-                char2 = dict[i + 1].word[h];
-                h += 1;
-            }
-            // Swap if all previous properties are identical
-            if (((char1 > char2) and (dict[i].nbD == dict[i + 1].nbD)) and
-                ((dict[i].nbT == dict[i + 1].nbT) and (dict[i].alpha == dict[i + 1].alpha)))
-            {
-                temp_element = dict[i];
-                dict[i] = dict[i + 1];
-                dict[i + 1] = temp_element;
-            }
-        }
-    }
-    return dict;
-}
-
-// Reads messages to analyze from standard input
-// Format: words separated by spaces, "." separates messages, "*" terminates
-// Returns a vector of messages (each message = vector of words)
-vector<vector<string>> create_messages()
-{
-    string element;
-    vector<vector<string>> message_list;
-    vector<string> message;
-    do
-    {
-        cin >> element;
-        if (element == "*")
-        { // End of all messages
-            if (!message.empty())
-            {
-                message_list.push_back(message); // Add last message
-                message.clear();
-            }
-            return message_list;
-        }
-        else if (element == ".")
-        { // End of a message
-            message_list.push_back(message);
-            message.clear();
-        }
-        else
-        { // New word of current message
-            message.push_back(element);
-        }
-    } while (true);
-}
-
-// Displays all words in the dictionary (one per line)
-void display_dictionary(vector<Word> dict)
-{
-    for (auto element : dict)
-    {
-        cout << element.word << endl;
-    }
-}
-
-// Sorts the letters of a message alphabetically (like sort_letters but for messages)
-// Uses bubble sort
-string sort_message_letters(string message)
-{
-    char temp;
-    for (size_t i(0); i < message.size() - 1; i++)
-    {
-        for (size_t j(0); j < message.size() - 1; j++)
-        {
-            if (message[j] > message[j + 1])
-            {
-                temp = message[j];
-                message[j] = message[j + 1];
-                message[j + 1] = temp;
-            }
-        }
-    }
-    return message;
-}
-
-// Checks if a message (sorted) contains all letters of a word
-// Uses a copy to mark already used letters with '0'
-bool message_contains_word(string alpha, Word element)
-{
-    int pos;
-    for (int i(0); i < element.nbT; i++)
-    {
-        pos = alpha.find(element.alpha[i]); // Search for the letter
-        if (pos != -1)
-        {
-            alpha[pos] = '0'; // Mark as used
-        }
-        else
-        {
-            return false; // Missing letter
-        }
-    }
-    return true; // All letters are present
-}
-
-// Removes the letters of a word from the message (sorted version)
-// Used after adding a word to the anagram
-string subtract_word_from_message(string alpha, Word element)
-{
-    for (int i(0); i < element.nbT; i++)
-    {
-        // Remove first occurrence of each letter
-        alpha.replace(alpha.find(element.alpha[i]), 1, "");
-    }
-    return alpha;
-}
-
-// Checks that all words in a message are uppercase
-bool is_all_uppercase(vector<string> message)
-{
-    bool uppercase(true);
-    for (size_t i(0); i < message.size(); i++)
-    {
-        if (!is_capital_letter(message[i]))
-        {
-            cout << NOT_IN_CAPITAL_LETTERS << endl;
-            uppercase = false;
-        }
-    }
-    return uppercase;
-}
-
-// Recursive anagram search function (backtracking algorithm)
-// Parameters:
-//   - dict: dictionary of still usable words
-//   - alpha_m: remaining message letters (sorted)
-//   - anagram: words already selected for the current anagram
-// Returns true if at least one anagram was found
-bool search_anagram(vector<Word> dict, string alpha_m, vector<string> anagram)
-{
-    if (dict.empty())
-    {
-        return false; // No more words available, failure
-    }
-    bool success(false);
-    // Try each word in the dictionary
-    for (size_t i(0); i < dict.size(); i++)
-    {
-        // Check if the word can be formed with remaining letters
-        if (message_contains_word(alpha_m, dict[i]))
-        {
-            // Create a new branch: add this word to the anagram
-            vector<string> next_anagram = anagram;
-            next_anagram.push_back(dict[i].word);
-            // Remove used letters from the message
-            string next_alpha_m = subtract_word_from_message(alpha_m, dict[i]);
-
-            if (next_alpha_m.empty())
-            {
-                // No remaining letters = complete anagram found!
-                for (size_t j(0); j < next_anagram.size(); j++)
-                {
-                    cout << next_anagram[j];
-                    if (j != next_anagram.size() - 1)
-                    {
-                        cout << " "; // Space between words
-                    }
-                }
-                cout << "\n";
-                success = true;
-            }
-            else
-            {
-                // Letters remain: continue search recursively
-                // Remove current word from dictionary to avoid duplicates
-                vector<Word> next_dict = remove_word(dict, i);
-                if (search_anagram(next_dict, next_alpha_m, next_anagram))
-                {
-                    success = true;
-                }
-            }
-        }
-    }
-    return success;
-}
-
-// Prepares and launches anagram search for a message
-// Initializes structures and optimizes dictionary before recursive call
-void find_anagrams(string message, vector<Word> dict)
-{
-    vector<string> anagram; // Empty vector to start recursion
-    string alpha_m;
-    alpha_m = sort_message_letters(message); // Sort message letters
-    dict = adapt_dictionary(dict, alpha_m);  // Optimization: remove impossible words
-
-    // Launch recursive search
-    if (!search_anagram(dict, alpha_m, anagram))
-    {
-        cout << NO_ANAGRAM << endl; // No anagram found
-    }
-}
-
-// Optimizes the dictionary by removing all words that cannot be formed
-// with the message letters (improves performance)
-vector<Word> adapt_dictionary(vector<Word> dict, string alpha_m)
-{
-    int size(dict.size());
-    for (int i(0); i < size; i++)
-    {
-        if (!message_contains_word(alpha_m, dict[i]))
-        {
-            // Shift all following elements to the left
-            for (size_t j(i); j < (dict.size() - 1); j++)
-            {
-                dict[j] = dict[j + 1];
-            }
-            dict.pop_back(); // Remove last element
-        }
-    }
-    return dict;
-}
-
-// Removes the i-th word from the dictionary
-// Used to avoid reusing a word already in the anagram
-vector<Word> remove_word(vector<Word> dict, int i)
-{
-    // Shift all following elements to the left
-    for (size_t j(i); j < dict.size() - 1; j++)
-    {
-        dict[j] = dict[j + 1];
-    }
-    dict.pop_back(); // Remove last element
-    return dict;
-
-}
+// Same-Granma.cc
+// Guillaume-Gentil Robin
+// version 4.1 - English Version
+//
+// ============================================================================
+// LICENSE AND COPYRIGHT
+// ============================================================================
+// Copyright (c) 2022 Guillaume-Gentil Robin
+//
+// This code is distributed under an open source license.
+//
+// You are free to:
+//   - Use this code for personal or commercial purposes
+//   - Modify and adapt this code to your needs
+//   - Distribute this code or modified versions
+//
+// Conditions:
+//   - Attribution is required: you must credit the original author
+//     (Guillaume-Gentil Robin) in any use or redistribution
+//   - This code is provided "as is", without warranty of any kind
+//
+// For questions or specific permission requests:
+//   Contact: robin_gg@icloud.com
+// ============================================================================
+
+#include "Same-Granma-internal.h"
+
+using namespace std;
+
+namespace granma
+{
+
+// Options of the engine with the default settings (those of the program without options)
+Options default_options()
+{
+    Options options;
+    options.recursive = false;
+    options.combinations = false;
+    options.permutations = false;
+    options.fewest_words = false;
+    options.memo_mb = 16;
+    options.cache_mb = 0;
+    options.threads = 1;
+    options.count_only = false;
+    options.totals = false;
+    options.first = 0;
+    options.max_bytes = 0;
+    options.max_words = 0;
+    options.min_words = 0;
+    options.min_length = 0;
+    options.time_limit = 0;
+    options.node_limit = 0;
+    options.shard_index = 0;
+    options.shard_count = 0;
+    options.shard_output = nullptr;
+    return options;
+}
+
+// Finds the required and excluded words in the dictionary
+// The letters of the required words are taken from each message before its search, and
+// those words are printed first. The required and excluded words are banned from the
+// search (a word is used once). A required word that is not in the dictionary, is also
+// excluded or is given twice makes every message without anagram.
+// Everything is found again at each call, so options can be resolved for another dictionary.
+void resolve_constraints(const SearchIndex& index, Options& options)
+{
+    options.required_words.clear();
+    options.required_counts = LetterCounts();
+    options.prefix.clear();
+    options.unusable = false;
+    options.banned.clear();
+    if (options.required.empty() and options.excluded.empty())
+    {
+        return;
+    }
+    options.banned.assign(index.nb_words, 0);
+    for (auto& element : options.excluded)
+    {
+        int i = find_word(index, element);
+        if (i >= 0)
+        {
+            options.banned[i] = 1;
+        }
+    }
+    for (auto& element : options.required)
+    {
+        int i = find_word(index, element);
+        if ((i < 0) or options.banned[i])
+        {
+            options.unusable = true;
+            continue;
+        }
+        options.banned[i] = 1;
+        options.required_words.push_back(i);
+        LetterCounts counts = count_letters(element);
+        for (int l(0); l <= NB_LETTERS; l++)
+        {
+            int sum = options.required_counts.count[l] + counts.count[l];
+            if (sum > MAX_LETTER_COUNT)
+            {
+                options.unusable = true; // Too many copies of a letter for any message
+                sum = MAX_LETTER_COUNT;
+            }
+            options.required_counts.count[l] = sum;
+        }
+        options.prefix += element + ' ';
+    }
+}
+
+// Index of a word in the sorted dictionary (-1 if it is not there)
+int find_word(const SearchIndex& index, const string& element)
+{
+    for (size_t i(0); i < index.nb_words; i++)
+    {
+        uint32_t length = index.offsets[i + 1] - index.offsets[i];
+        if ((length == element.size()) and (memcmp(index.pool + index.offsets[i], element.data(), length) == 0))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Reads the words of the dictionary into the pool of dict
+// The source gives the words up to the end of the dictionary (a "." on standard input)
+// Reading stops at the first word not in capital letters: then the dictionary is invalid
+// and the function returns false. The other errors (empty dictionary, duplicate word)
+// are found by check_dictionary once the dictionary is sorted.
+bool create_dictionary(const WordSource& source, Dictionary& dict)
+{
+    string element;
+    while (source(element))
+    { // New word to add
+        if (!is_capital_letter(element))
+        { // Check uppercase
+            return false;
+        }
+        add_word(dict, element.data(), element.size());
+    }
+    return true;
+}
+
+// Checks the sorted dictionary, read up to its end (capitals) or up to a word not in
+// capital letters (the words before it are in dict)
+// A word given twice is next to its copy once sorted. Errors are reported as if the
+// words were checked one by one in input order: a copy read before the lowercase word
+// comes first, and an empty dictionary is an error only if it was read to its end.
+// Returns FOUND if the dictionary is valid
+GranmaStatus check_dictionary(const Dictionary& dict, bool capitals)
+{
+    for (size_t i(1); i < dict.size(); i++)
+    {
+        if ((dict.nbT[i] == dict.nbT[i - 1]) and (compare_words(dict, i - 1, i) == 0))
+        { // Check no duplicate
+            return GranmaStatus::DOUBLE_WORD;
+        }
+    }
+    if (!capitals)
+    {
+        return GranmaStatus::NOT_IN_CAPITAL_LETTERS;
+    }
+    return (dict.size() == 0) ? GranmaStatus::EMPTY_DICT : GranmaStatus::FOUND;
+}
+
+// Checks that all characters of a word are uppercase (A-Z: ASCII 65-90)
+bool is_capital_letter(const string& element)
+{
+    int character;
+    for (size_t i(0); i < element.size(); i++)
+    {
+        character = element[i];
+        if ((character < 65) or (character > 90))
+        { // Outside the A-Z range
+            return false;
+        }
+    }
+    return true;
+}
+
+// Appends a word to the pool of the dictionary (its properties are set by convert)
+void add_word(Dictionary& dict, const char* letters, size_t size)
+{
+    if (dict.offsets.empty())
+    {
+        dict.offsets.push_back(0);
+    }
+    dict.pool.insert(dict.pool.end(), letters, letters + size);
+    dict.offsets.push_back(dict.pool.size());
+}
+
+// Calculates the properties of all the words of the pool: nbT, nbD, letter mask and
+// letter counts, each into its own array
+void convert(Dictionary& dict)
+{
+    size_t nb_words = dict.size();
+    dict.nbT.resize(nb_words);
+    dict.nbD.resize(nb_words);
+    dict.masks.resize(nb_words);
+    dict.counts.resize(nb_words);
+    string element;
+    for (size_t i(0); i < nb_words; i++)
+    {
+        element.assign(dict.pool.data() + dict.offsets[i], dict.offsets[i + 1] - dict.offsets[i]);
+        dict.nbT[i] = element.size();                  // Total number of letters
+        dict.nbD[i] = count_distinct_letters(element); // Number of distinct letters
+        dict.counts[i] = count_letters(element);       // Letter-count vector
+        dict.masks[i] = letter_mask(dict.counts[i]);   // Letters present
+    }
+}
+
+// Calculates the number of distinct letters in a word
+// Example: "HELLO" -> 4 distinct letters (H, E, L, O)
+int count_distinct_letters(const string& element)
+{
+    bool present[NB_LETTERS] = {};
+    int distinct(0);
+    for (auto letter : element)
+    {
+        if (!present[letter - 'A'])
+        {
+            present[letter - 'A'] = true;
+            distinct += 1;
+        }
+    }
+    return distinct;
+}
+
+// Sorts the letters of a word alphabetically
+// Example: "CAB" -> "ABC", "HELLO" -> "EHLLO"
+// Uses counting sort: counts each letter, then writes the letters from A to Z
+string sort_letters(const string& element)
+{
+    size_t occurrences[NB_LETTERS] = {};
+    for (auto letter : element)
+    {
+        occurrences[letter - 'A'] += 1;
+    }
+    string characters;
+    characters.reserve(element.size());
+    for (int l(0); l < NB_LETTERS; l++)
+    {
+        characters.append(occurrences[l], static_cast<char>('A' + l));
+    }
+    return characters;
+}
+
+// Groups the words of the sorted dictionary into anagram classes (same alpha)
+// Sorting puts words with the same alpha next to each other, so each class is a range
+// Example: ARTS RATS STAR TSAR -> one class of 4 words
+// If group_anagrams is false, each word is a class on its own
+vector<AnagramClass> create_classes(const Dictionary& dict, bool group_anagrams)
+{
+    vector<AnagramClass> classes;
+    AnagramClass c;
+    for (size_t i(0); i < dict.size(); i++)
+    {
+        if (group_anagrams and (i > 0) and (dict.nbT[i] == dict.nbT[i - 1]) and (compare_letters(dict, i - 1, i) == 0))
+        {
+            classes.back().size += 1; // Same letters as the previous word
+        }
+        else
+        {
+            c.counts = dict.counts[i];
+            c.first = i;
+            c.size = 1;
+            classes.push_back(c);
+        }
+    }
+    return classes;
+}
+
+// Compares the sorted letters (alpha) of two words of the same length, from their letter
+// counts: the first letter whose counts differ decides, and the word with more copies
+// of it comes first (AAB < ABB). Counts that saturated are compared on alpha itself.
+// Returns a negative number, 0 or a positive number as for strcmp
+int compare_letters(const Dictionary& dict, size_t a, size_t b)
+{
+    const LetterCounts& first = dict.counts[a];
+    const LetterCounts& second = dict.counts[b];
+    for (int l(0); l < NB_LETTERS; l++)
+    {
+        if (first.count[l] != second.count[l])
+        {
+            return int(second.count[l]) - int(first.count[l]);
+        }
+    }
+    if ((first.count[NB_LETTERS] != 0) or (second.count[NB_LETTERS] != 0))
+    {
+        // More than MAX_LETTER_COUNT copies of a letter
+        string alpha_a = sort_letters(string(dict.pool.data() + dict.offsets[a], dict.nbT[a]));
+        string alpha_b = sort_letters(string(dict.pool.data() + dict.offsets[b], dict.nbT[b]));
+        return alpha_a.compare(alpha_b);
+    }
+    return 0;
+}
+
+// Compares two words of the pool in alphabetical order
+// Returns a negative number, 0 or a positive number as for strcmp
+int compare_words(const Dictionary& dict, size_t a, size_t b)
+{
+    size_t size_a = dict.offsets[a + 1] - dict.offsets[a];
+    size_t size_b = dict.offsets[b + 1] - dict.offsets[b];
+    int order = memcmp(dict.pool.data() + dict.offsets[a], dict.pool.data() + dict.offsets[b], min(size_a, size_b));
+    if (order != 0)
+    {
+        return order;
+    }
+    return (size_a < size_b) ? -1 : (size_a > size_b) ? 1 : 0;
+}
+
+// Builds the index of the sorted dictionary: the letters of all the words in one pool,
+// the start of each word in the pool, and the two class tables
+// The index takes the pool and offsets of the dictionary (dict is left without them)
+void create_index(Dictionary& dict, SearchIndex& index)
+{
+    index.class_data = create_classes(dict, true);
+    index.word_data = create_classes(dict, false);
+    index.pool_data.swap(dict.pool);
+    index.offset_data.swap(dict.offsets);
+    if (index.offset_data.empty())
+    {
+        index.offset_data.push_back(0);
+    }
+
+    for (auto& element : index.class_data)
+    {
+        index.class_mask_data.push_back(dict.masks[element.first]);
+    }
+    index.word_mask_data.swap(dict.masks);
+
+    index.pool = index.pool_data.data();
+    index.offsets = index.offset_data.data();
+    index.nb_words = index.offset_data.size() - 1;
+    index.classes.data = index.class_data.data();
+    index.classes.masks = index.class_mask_data.data();
+    index.classes.count = index.class_data.size();
+    index.words.data = index.word_data.data();
+    index.words.masks = index.word_mask_data.data();
+    index.words.count = index.word_data.size();
+    index.trie_data = create_trie(index.classes);
+    index.trie = index.trie_data.data();
+    index.nb_nodes = index.trie_data.size();
+    index.mapping = nullptr;
+    index.mapping_size = 0;
+}
+
+// Writes the index to a file: the header, then the arrays, each padded to 8 bytes
+// Returns false if the file cannot be written (an old file at that path is kept)
+bool write_index(const SearchIndex& index, const string& path)
+{
+    static_assert(sizeof(IndexHeader) % 8 == 0, "The arrays of an index file must stay aligned");
+    static_assert(sizeof(TrieNode) == 16, "Trie nodes are stored without padding");
+    IndexHeader header = {};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.class_size = sizeof(AnagramClass);
+    header.nb_words = index.nb_words;
+    header.nb_classes = index.classes.size();
+    header.pool_size = index.offsets[index.nb_words];
+
+    vector<char> body; // Everything after the header
+    auto add_array = [&](const void* data, size_t size)
+    {
+        uint64_t offset = sizeof(IndexHeader) + body.size();
+        body.insert(body.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+        body.resize((body.size() + 7) / 8 * 8, 0);
+        return offset;
+    };
+    header.pool_offset = add_array(index.pool, header.pool_size);
+    header.offsets_offset = add_array(index.offsets, (index.nb_words + 1) * sizeof(uint32_t));
+    header.classes_offset = add_array(index.classes.data, index.classes.size() * sizeof(AnagramClass));
+    header.words_offset = add_array(index.words.data, index.words.size() * sizeof(AnagramClass));
+    header.class_masks_offset = add_array(index.classes.masks, index.classes.size() * sizeof(uint32_t));
+    header.word_masks_offset = add_array(index.words.masks, index.words.size() * sizeof(uint32_t));
+    header.nb_nodes = index.nb_nodes;
+    header.trie_offset = add_array(index.trie, index.nb_nodes * sizeof(TrieNode));
+    header.file_size = sizeof(IndexHeader) + body.size();
+    header.checksum = index_checksum(body.data(), body.size());
+
+    // The file is written beside the old one, then renamed over it: a program that maps the
+    // old file (a server) keeps it intact, and a reload never sees a partial file
+    string temporary = path + ".tmp";
+    ofstream file(temporary, ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(body.data(), body.size());
+    file.close();
+#if defined(_WIN32)
+    remove(path.c_str()); // rename does not replace a file on Windows
+#endif
+    if (!file or (rename(temporary.c_str(), path.c_str()) != 0))
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Maps an index file written by --build-index and points the index at its arrays
+// The identification, version, sizes and checksum of the file are checked first.
+// The mapping stays until release_index.
+// Returns false, with nothing mapped, if the file cannot be read or is not valid
+bool map_index(const string& path, SearchIndex& index)
+{
+    const char* data(nullptr);
+    size_t size(0);
+    index.mapping = nullptr;
+    index.mapping_size = 0;
+#ifdef NO_MMAP
+    ifstream file(path, ios::binary | ios::ate);
+    if (file)
+    {
+        size = file.tellg();
+        index.file_data.resize(size / 8 + 1); // 8-byte aligned copy of the file
+        file.seekg(0);
+        if (file.read(reinterpret_cast<char*>(index.file_data.data()), size))
+        {
+            data = reinterpret_cast<const char*>(index.file_data.data());
+        }
+    }
+#else
+    int descriptor = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if ((descriptor >= 0) and (fstat(descriptor, &status) == 0) and (status.st_size > 0))
+    {
+        size = status.st_size;
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping != MAP_FAILED)
+        {
+            index.mapping = mapping;
+            index.mapping_size = size;
+            data = static_cast<const char*>(mapping);
+        }
+    }
+    if (descriptor >= 0)
+    {
+        close(descriptor);
+    }
+#endif
+
+    // An array fits if it is aligned and inside the file
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t width)
+    {
+        return (offset % 8 == 0) and (offset <= size) and (count <= (size - offset) / width);
+    };
+    IndexHeader header;
+    bool valid = (data != nullptr) and (size >= sizeof(IndexHeader));
+    if (valid)
+    {
+        memcpy(&header, data, sizeof(header));
+        valid = (memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0) and
+                (header.version == INDEX_VERSION) and (header.class_size == sizeof(AnagramClass)) and
+                (header.file_size == size) and (header.nb_words > 0) and
+                fits(header.pool_offset, header.pool_size, 1) and
+                fits(header.offsets_offset, header.nb_words + 1, sizeof(uint32_t)) and
+                fits(header.classes_offset, header.nb_classes, sizeof(AnagramClass)) and
+                fits(header.words_offset, header.nb_words, sizeof(AnagramClass)) and
+                fits(header.class_masks_offset, header.nb_classes, sizeof(uint32_t)) and
+                fits(header.word_masks_offset, header.nb_words, sizeof(uint32_t)) and
+                (header.nb_nodes > 0) and fits(header.trie_offset, header.nb_nodes, sizeof(TrieNode)) and
+                (index_checksum(data + sizeof(IndexHeader), size - sizeof(IndexHeader)) == header.checksum);
+    }
+    if (valid)
+    {
+        index.pool = data + header.pool_offset;
+        index.offsets = reinterpret_cast<const uint32_t*>(data + header.offsets_offset);
+        index.nb_words = header.nb_words;
+        index.classes.data = reinterpret_cast<const AnagramClass*>(data + header.classes_offset);
+        index.classes.masks = reinterpret_cast<const uint32_t*>(data + header.class_masks_offset);
+        index.classes.count = header.nb_classes;
+        index.words.data = reinterpret_cast<const AnagramClass*>(data + header.words_offset);
+        index.words.masks = reinterpret_cast<const uint32_t*>(data + header.word_masks_offset);
+        index.words.count = header.nb_words;
+        index.trie = reinterpret_cast<const TrieNode*>(data + header.trie_offset);
+        index.nb_nodes = header.nb_nodes;
+        valid = (index.offsets[0] == 0) and (index.offsets[index.nb_words] == header.pool_size);
+    }
+    if (!valid)
+    {
+        release_index(index);
+    }
+    return valid;
+}
+
+// Unmaps the index file of an index loaded by map_index (its arrays become invalid)
+void release_index(SearchIndex& index)
+{
+#ifndef NO_MMAP
+    if (index.mapping != nullptr)
+    {
+        munmap(index.mapping, index.mapping_size);
+    }
+#endif
+    index.mapping = nullptr;
+    index.mapping_size = 0;
+    vector<uint64_t>().swap(index.file_data);
+}
+
+// Checksum of the body of an index file (FNV-1a on 64-bit blocks, then on the last bytes)
+uint64_t index_checksum(const char* data, size_t size)
+{
+    const uint64_t prime(1099511628211ULL);
+    uint64_t hash(14695981039346656037ULL);
+    uint64_t block;
+    size_t i(0);
+    for (; i + 8 <= size; i += 8)
+    {
+        memcpy(&block, data + i, sizeof(block));
+        hash = (hash ^ block) * prime;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * prime;
+    }
+    return hash;
+}
+
+// Appends the i-th word of the sorted dictionary to the text
+void append_word(string& text, const SearchIndex& index, int i)
+{
+    text.append(index.pool + index.offsets[i], index.offsets[i + 1] - index.offsets[i]);
+}
+
+// Builds the letter-count trie over the alpha keys of the classes (see TrieNode)
+// Each key is written as its edges (letter, copies); the keys are sorted, so the classes
+// below a node form a range whose first class ends there if its key is that long. The
+// nodes are laid out level by level: the children of each node are contiguous, in order.
+// A class with a letter repeated more than MAX_LETTER_COUNT times fits no message and is
+// left out.
+vector<TrieNode> create_trie(const ClassTable& classes)
+{
+    vector<uint16_t> edges;     // Edges of all the keys, letter * 256 + copies
+    vector<uint32_t> key_start; // Key of class c = edges key_start[c] to key_start[c + 1] - 1
+    vector<int> order;          // Classes that can fit a message, sorted by key
+    for (size_t c(0); c < classes.size(); c++)
+    {
+        const LetterCounts& counts = classes[c].counts;
+        key_start.push_back(edges.size());
+        if (counts.count[NB_LETTERS] == 0)
+        {
+            for (int l(0); l < NB_LETTERS; l++)
+            {
+                if (counts.count[l] != 0)
+                {
+                    edges.push_back(l * 256 + counts.count[l]);
+                }
+            }
+            order.push_back(c);
+        }
+    }
+    key_start.push_back(edges.size());
+    const uint16_t* edge = edges.data();
+    const uint32_t* start = key_start.data();
+    sort(order.begin(), order.end(),
+         [edge, start](int a, int b)
+         {
+             return lexicographical_compare(edge + start[a], edge + start[a + 1], edge + start[b],
+                                            edge + start[b + 1]);
+         });
+
+    // Node i covers the classes order[range[i]] to order[range[i + 1] - 1], whose keys
+    // share their first `depth` edges
+    struct Range
+    {
+        size_t begin;
+        size_t end;
+        uint32_t depth;
+    };
+    TrieNode root = {0, 0, -1, 0, 0};
+    vector<TrieNode> trie(1, root);
+    vector<Range> ranges(1, Range{0, order.size(), 0});
+    for (size_t i(0); i < trie.size(); i++)
+    {
+        Range range = ranges[i];
+        if ((range.begin < range.end) and (start[order[range.begin] + 1] - start[order[range.begin]] == range.depth))
+        {
+            trie[i].key_class = order[range.begin]; // The key ends here
+            range.begin += 1;
+        }
+        trie[i].first_child = trie.size();
+        while (range.begin < range.end)
+        {
+            uint16_t next = edge[start[order[range.begin]] + range.depth];
+            size_t end(range.begin + 1);
+            while ((end < range.end) and (edge[start[order[end]] + range.depth] == next))
+            {
+                end += 1;
+            }
+            TrieNode child = {static_cast<uint16_t>(next / 256), static_cast<uint16_t>(next % 256), -1, 0, 0};
+            trie.push_back(child);
+            ranges.push_back(Range{range.begin, end, range.depth + 1});
+            range.begin = end;
+        }
+        trie[i].end_child = trie.size();
+    }
+    return trie;
+}
+
+// Appends to found the classes whose letters all fit in the remaining letters
+// One depth-first walk of the trie: an edge is followed only if its copies of its letter
+// remain, and the edges of the same letter that need more copies are skipped with it
+// (each letter appears at most once on a path, so nothing is subtracted).
+// stack: work space of the walk
+void walk_trie(const SearchIndex& index, const LetterCounts& remaining, vector<int>& found, vector<uint32_t>& stack)
+{
+    const TrieNode* trie = index.trie;
+    stack.assign(1, 0);
+    while (!stack.empty())
+    {
+        const TrieNode& node = trie[stack.back()];
+        stack.pop_back();
+        if (node.key_class >= 0)
+        {
+            found.push_back(node.key_class);
+        }
+        uint32_t child(node.first_child);
+        while (child < node.end_child)
+        {
+            int letter = trie[child].letter;
+            if (trie[child].copies <= remaining.count[letter])
+            {
+                stack.push_back(child);
+                child += 1;
+            }
+            else
+            {
+                while ((child < node.end_child) and (trie[child].letter == letter))
+                {
+                    child += 1; // More copies of a letter that does not fit
+                }
+            }
+        }
+    }
+}
+
+// Class made of exactly the letters of counts, or -1 if there is none
+// Follows the path of the trie that spells the letters (one edge per letter present)
+int find_class(const SearchIndex& index, const LetterCounts& counts)
+{
+    const TrieNode* trie = index.trie;
+    uint32_t node(0);
+    for (int letter(0); letter < NB_LETTERS; letter++)
+    {
+        if (counts.count[letter] == 0)
+        {
+            continue;
+        }
+        uint32_t child(trie[node].first_child);
+        while ((child < trie[node].end_child) and
+               ((trie[child].letter != letter) or (trie[child].copies != counts.count[letter])))
+        {
+            child += 1;
+        }
+        if (child == trie[node].end_child)
+        {
+            return -1; // No class has these letters
+        }
+        node = child;
+    }
+    return trie[node].key_class;
+}
+
+// Sorts the dictionary on 4 levels, in one sort on the composite key:
+// 1. by total number of letters (ascending)
+// 2. same total: by number of distinct letters (ascending)
+// 3. same total and distinct letters: by sorted letters (alpha), so anagrams are grouped
+// 4. same alpha: alphabetical order of the word
+// Words are unique, so the order is total and does not depend on the input order
+// The sort orders the word numbers, then each array is rebuilt in that order
+void sort_dictionary(Dictionary& dict)
+{
+    vector<uint32_t> order(dict.size());
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&dict](uint32_t a, uint32_t b)
+    {
+        if (dict.nbT[a] != dict.nbT[b])
+        {
+            return dict.nbT[a] < dict.nbT[b];
+        }
+        if (dict.nbD[a] != dict.nbD[b])
+        {
+            return dict.nbD[a] < dict.nbD[b];
+        }
+        int letters = compare_letters(dict, a, b);
+        if (letters != 0)
+        {
+            return letters < 0;
+        }
+        return compare_words(dict, a, b) < 0;
+    });
+
+    Dictionary sorted;
+    sorted.pool.reserve(dict.pool.size());
+    sorted.offsets.reserve(dict.offsets.size());
+    sorted.nbT.reserve(order.size());
+    sorted.nbD.reserve(order.size());
+    sorted.masks.reserve(order.size());
+    sorted.counts.reserve(order.size());
+    for (auto i : order)
+    {
+        add_word(sorted, dict.pool.data() + dict.offsets[i], dict.nbT[i]);
+        sorted.nbT.push_back(dict.nbT[i]);
+        sorted.nbD.push_back(dict.nbD[i]);
+        sorted.masks.push_back(dict.masks[i]);
+        sorted.counts.push_back(dict.counts[i]);
+    }
+    swap(dict, sorted);
+}
+
+// Displays all words in the dictionary (one per line)
+void display_dictionary(const SearchIndex& index, ostream& out)
+{
+    string word;
+    for (size_t i(0); i < index.nb_words; i++)
+    {
+        word.clear();
+        append_word(word, index, i);
+        out << word << '\n';
+    }
+}
+
+// Builds the letter-count vector of a word or of a message
+// Example: "HELLO" -> E:1, H:1, L:2, O:1
+// A count above MAX_LETTER_COUNT saturates and sets the overflow lane count[NB_LETTERS]
+LetterCounts count_letters(const string& element)
+{
+    LetterCounts counts = {};
+    int letter;
+    for (auto character : element)
+    {
+        letter = character - 'A';
+        if (counts.count[letter] == MAX_LETTER_COUNT)
+        {
+            counts.count[NB_LETTERS] = 1; // Too many copies of this letter
+        }
+        else
+        {
+            counts.count[letter] += 1;
+        }
+    }
+    return counts;
+}
+
+// Checks that the word needs no more copies of any letter than the message has
+// The saturated difference (word - message) is zero in every lane exactly when the word fits
+bool counts_contain(const LetterCounts& message, const LetterCounts& word)
+{
+#if defined(__AVX2__)
+    __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(message.count));
+    __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(word.count));
+    __m256i excess = _mm256_subs_epu8(w, m);
+    return _mm256_testz_si256(excess, excess);
+#elif defined(__SSE2__)
+    __m128i m_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(message.count));
+    __m128i m_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(message.count + 16));
+    __m128i w_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(word.count));
+    __m128i w_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(word.count + 16));
+    __m128i excess = _mm_or_si128(_mm_subs_epu8(w_low, m_low), _mm_subs_epu8(w_high, m_high));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(excess, _mm_setzero_si128())) == 0xFFFF;
+#else
+    for (int i(0); i < COUNTS_WIDTH; i++)
+    {
+        if (word.count[i] > message.count[i])
+        {
+            return false; // Missing letter
+        }
+    }
+    return true;
+#endif
+}
+
+// Subtracts the letter counts of a word from the message
+// The word must fit in the message (see counts_contain)
+void subtract_counts(LetterCounts& message, const LetterCounts& word)
+{
+#if defined(__AVX2__)
+    __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(message.count));
+    __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(word.count));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(message.count), _mm256_sub_epi8(m, w));
+#elif defined(__SSE2__)
+    for (int i(0); i < COUNTS_WIDTH; i += 16)
+    {
+        __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(message.count + i));
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(word.count + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(message.count + i), _mm_sub_epi8(m, w));
+    }
+#else
+    for (int i(0); i < COUNTS_WIDTH; i++)
+    {
+        message.count[i] -= word.count[i];
+    }
+#endif
+}
+
+// Total number of letters of a word or of the remaining letters of a message
+int count_total(const LetterCounts& counts)
+{
+#if defined(__AVX2__)
+    __m256i sums = _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(counts.count)),
+                                   _mm256_setzero_si256());
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    return _mm_cvtsi128_si32(_mm_add_epi64(half, _mm_unpackhi_epi64(half, half)));
+#elif defined(__SSE2__)
+    __m128i sums =
+        _mm_add_epi64(_mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(counts.count)), _mm_setzero_si128()),
+                      _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(counts.count + 16)),
+                                   _mm_setzero_si128()));
+    return _mm_cvtsi128_si32(_mm_add_epi64(sums, _mm_unpackhi_epi64(sums, sums)));
+#else
+    int total(0);
+    for (int i(0); i < COUNTS_WIDTH; i++)
+    {
+        total += counts.count[i];
+    }
+    return total;
+#endif
+}
+
+// Checks that no letter remains in the message
+bool counts_empty(const LetterCounts& message)
+{
+#if defined(__AVX2__)
+    __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(message.count));
+    return _mm256_testz_si256(m, m);
+#elif defined(__SSE2__)
+    __m128i m = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(message.count)),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(message.count + 16)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128())) == 0xFFFF;
+#else
+    for (int i(0); i < COUNTS_WIDTH; i++)
+    {
+        if (message.count[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+#endif
+}
+
+// Letters present in a letter-count vector: bit l is set when letter 'A' + l is there
+uint32_t letter_mask(const LetterCounts& counts)
+{
+#if defined(__AVX2__)
+    __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(counts.count));
+    uint32_t zero = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_setzero_si256()));
+    return ~zero & ((1u << NB_LETTERS) - 1);
+#else
+    uint32_t mask(0);
+    for (int l(0); l < NB_LETTERS; l++)
+    {
+        mask |= uint32_t(counts.count[l] != 0) << l;
+    }
+    return mask;
+#endif
+}
+
+// Copies to kept the classes of list (count of them) that fit in the remaining letters,
+// except skip (-1 for none), in the same order; kept may be list itself
+// Most classes that do not fit use a letter that is gone: their mask rejects them before
+// their letter counts are read. With AVX2 the masks of 8 classes are gathered and tested
+// at once, and only the survivors get the full count check.
+// Returns the number of classes kept
+size_t keep_fitting(const ClassTable& classes, const int* list, size_t count, const LetterCounts& remaining,
+                    int skip, int* kept)
+{
+    uint32_t absent = ~letter_mask(remaining);
+    size_t nb_kept(0);
+    size_t i(0);
+#if defined(__AVX2__)
+    const __m256i absent_lanes = _mm256_set1_epi32(absent);
+    const __m256i skip_lanes = _mm256_set1_epi32(skip);
+    const __m256i zero = _mm256_setzero_si256();
+    const int* masks = reinterpret_cast<const int*>(classes.masks);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(list + i));
+        __m256i letters = _mm256_i32gather_epi32(masks, indices, 4);
+        __m256i possible = _mm256_andnot_si256(_mm256_cmpeq_epi32(indices, skip_lanes),
+                                               _mm256_cmpeq_epi32(_mm256_and_si256(letters, absent_lanes), zero));
+        int survivors = _mm256_movemask_ps(_mm256_castsi256_ps(possible));
+        for (int j(0); survivors != 0; j++, survivors >>= 1)
+        {
+            if ((survivors & 1) and counts_contain(remaining, classes[list[i + j]].counts))
+            {
+                kept[nb_kept] = list[i + j];
+                nb_kept += 1;
+            }
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        int c = list[i];
+        if ((c != skip) and ((classes.masks[c] & absent) == 0) and counts_contain(remaining, classes[c].counts))
+        {
+            kept[nb_kept] = c;
+            nb_kept += 1;
+        }
+    }
+    return nb_kept;
+}
+
+// Copies to kept the classes of list made of exactly the remaining letters, except skip,
+// in the same order; kept may be list itself
+// With one word left, only they can end the anagram: the class is found in the trie
+// (with one class per word, the candidates are the words of that class), and the list
+// is only compared with it instead of testing the letters of every candidate.
+// Returns the number of classes kept
+size_t keep_last_word(const SearchIndex& index, const ClassTable& classes, const int* list, size_t count,
+                      const LetterCounts& remaining, int skip, int* kept)
+{
+    int c = find_class(index, remaining);
+    if (c < 0)
+    {
+        return 0;
+    }
+    int first(c), end(c + 1);
+    if (classes.data != index.classes.data)
+    {
+        first = index.classes[c].first;
+        end = first + index.classes[c].size;
+    }
+    size_t nb_kept(0);
+    for (size_t i(0); i < count; i++)
+    {
+        if ((list[i] >= first) and (list[i] < end) and (list[i] != skip))
+        {
+            kept[nb_kept] = list[i];
+            nb_kept += 1;
+        }
+    }
+    return nb_kept;
+}
+
+// Adds 1 to the lanes of the letters that the word contains (saturates at 255)
+// Summed over a candidate list, gives the number of candidates containing each letter
+void add_presence(LetterCounts& total, const LetterCounts& word)
+{
+#if defined(__AVX2__)
+    __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(total.count));
+    __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(word.count));
+    w = _mm256_min_epu8(w, _mm256_set1_epi8(1));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(total.count), _mm256_adds_epu8(t, w));
+#elif defined(__SSE2__)
+    for (int i(0); i < COUNTS_WIDTH; i += 16)
+    {
+        __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(total.count + i));
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(word.count + i));
+        w = _mm_min_epu8(w, _mm_set1_epi8(1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(total.count + i), _mm_adds_epu8(t, w));
+    }
+#else
+    for (int i(0); i < COUNTS_WIDTH; i++)
+    {
+        if ((word.count[i] != 0) and (total.count[i] != MAX_LETTER_COUNT))
+        {
+            total.count[i] += 1;
+        }
+    }
+#endif
+}
+
+// Checks if the remaining message letters contain all letters of the i-th word
+bool message_contains_word(const LetterCounts& alpha_m, const Dictionary& dict, int i)
+{
+    return counts_contain(alpha_m, dict.counts[i]);
+}
+
+// Removes the letters of the i-th word from the remaining message letters
+// Used after adding a word to the anagram
+LetterCounts subtract_word_from_message(LetterCounts alpha_m, const Dictionary& dict, int i)
+{
+    subtract_counts(alpha_m, dict.counts[i]);
+    return alpha_m;
+}
+
+// Checks that all words in a message (separated by white space) are uppercase, printing
+// a line for each one that is not, and concatenates them into letters
+bool is_all_uppercase(const string& message, SearchArena& arena, string& letters)
+{
+    bool uppercase(true);
+    istringstream words(message);
+    string element;
+    letters.clear();
+    while (words >> element)
+    {
+        if (!is_capital_letter(element))
+        {
+            write_text(arena, NOT_IN_CAPITAL_LETTERS + "\n");
+            uppercase = false;
+        }
+        letters += element;
+    }
+    return uppercase;
+}
+
+// Prints text on the output of the arena (a buffer in batch or parallel mode)
+void write_text(SearchArena& arena, const string& text)
+{
+    write_output(arena.sink, arena.output, text);
+}
+
+// Appends text to the buffer, or prints it on the stream of the sink if output is nullptr
+void write_output(const OutputSink& sink, string* output, const string& text)
+{
+    if (output != nullptr)
+    {
+        output->append(text);
+    }
+    else
+    {
+        *sink.stream << text;
+    }
+}
+
+// Starts counting the anagrams of a message, with the limits of the options
+void reset_sink(OutputSink& sink, const Options& options)
+{
+    sink.count_only = options.count_only;
+    sink.first = options.first;
+    sink.max_bytes = options.max_bytes;
+    sink.count = 0;
+    sink.bytes = 0;
+    sink.stopped = false;
+    sink.truncated = false;
+}
+
+// Prints an anagram line (or only counts it with --count)
+// A line that would go over --max-bytes is not printed, and the search stops;
+// the search also stops once --first anagrams are printed
+void emit_anagram(OutputSink& sink, string* output, const string& line)
+{
+    if (sink.stopped)
+    {
+        return;
+    }
+    if (sink.count_only)
+    {
+        add_anagrams(sink, 1);
+        return;
+    }
+    if ((sink.max_bytes != 0) and (sink.bytes + line.size() > (unsigned long long)sink.max_bytes))
+    {
+        sink.stopped = true;
+        return;
+    }
+    sink.bytes += line.size();
+    sink.count += 1;
+    if (sink.callback != nullptr)
+    {
+        if (!(*sink.callback)(line.substr(0, line.size() - 1))) // Without the end of line
+        {
+            sink.stopped = true; // The caller has enough
+            return;
+        }
+    }
+    else
+    {
+        write_output(sink, output, line);
+    }
+    if ((sink.first != 0) and (sink.count >= (unsigned long long)sink.first))
+    {
+        sink.stopped = true;
+    }
+}
+
+// Checks the time and node limits of the message (--time-limit, --node-limit), once the
+// arena reaches arena.next_check nodes (0 at the start of a search), just before a node is
+// expanded: a search that needs exactly --node-limit nodes is not truncated
+// Past a limit, the search stops as it does at an output limit, keeping what it printed,
+// and is marked truncated. The next check comes SPLIT_INTERVAL nodes later, or exactly at
+// the node limit, so a search never places more than --node-limit words.
+// In a parallel search the workers take their nodes from the scheduler, at most
+// SPLIT_INTERVAL at a time, until --node-limit nodes are given out: a worker whose
+// nodes are used up and gets none stops. The time limit stops all the workers.
+// Returns true if the search must stop
+bool check_limits(const Options& options, SearchArena& arena)
+{
+    Scheduler* scheduler = arena.scheduler;
+    bool out_of_time = (options.time_limit != 0) and (chrono::steady_clock::now() >= arena.deadline);
+    long long step(SPLIT_INTERVAL);
+    if (!out_of_time and (options.node_limit != 0))
+    {
+        if (scheduler == nullptr)
+        {
+            step = min(step, options.node_limit - arena.nodes);
+        }
+        else
+        {
+            long long given = scheduler->nodes;
+            do
+            {
+                step = min<long long>(SPLIT_INTERVAL, options.node_limit - given);
+            } while ((step > 0) and !scheduler->nodes.compare_exchange_weak(given, given + step));
+        }
+    }
+    if (out_of_time or (step <= 0))
+    {
+        arena.sink.stopped = true;
+        arena.sink.truncated = true;
+        if (scheduler != nullptr)
+        {
+            scheduler->truncated = true;
+            scheduler->stop = scheduler->stop or out_of_time; // The others use up their nodes
+        }
+        return true;
+    }
+    arena.next_check = arena.nodes + step;
+    return false;
+}
+
+// Gives the nodes granted to a worker of a parallel search and not used back to the
+// scheduler (the worker has no task), so that the other workers can use them
+void return_nodes(const Options& options, SearchArena& arena)
+{
+    if ((options.node_limit != 0) and (arena.next_check > arena.nodes))
+    {
+        arena.scheduler->nodes -= arena.next_check - arena.nodes;
+        arena.next_check = arena.nodes;
+    }
+}
+
+// Counts anagrams without printing them (--count), up to the --first limit
+// The count saturates at the largest unsigned long long
+void add_anagrams(OutputSink& sink, unsigned long long count)
+{
+    if (sink.stopped)
+    {
+        return;
+    }
+    sink.count = (count > ULLONG_MAX - sink.count) ? ULLONG_MAX : sink.count + count;
+    if ((sink.first != 0) and (sink.count >= (unsigned long long)sink.first))
+    {
+        sink.count = sink.first;
+        sink.stopped = true;
+    }
+}
+
+// Number of lines printed for the nb_words classes of chosen (sorted if they repeat):
+// the product of the number of combinations of k words of each class chosen k times,
+// times the number of word orders with --permutations (the words are all different)
+// Saturates at the largest unsigned long long
+unsigned long long count_choices(const ClassTable& classes, const int* chosen, int nb_words, bool permutations)
+{
+    unsigned long long total(1);
+    unsigned long long factor(1);
+    int k(0);
+    for (int j(0); j < nb_words; j++)
+    {
+        // Combinations of k + 1 words of the class: C(n, k + 1) = C(n, k) * (n - k) / (k + 1)
+        k = ((j > 0) and (chosen[j] == chosen[j - 1])) ? k + 1 : 0;
+        factor = (k == 0) ? classes[chosen[j]].size : factor * (classes[chosen[j]].size - k) / (k + 1);
+        if ((j + 1 == nb_words) or (chosen[j + 1] != chosen[j]))
+        {
+            total = (factor != 0 and total > ULLONG_MAX / factor) ? ULLONG_MAX : total * factor;
+        }
+    }
+    for (int j(2); permutations and (j <= nb_words); j++)
+    {
+        total = (total > ULLONG_MAX / j) ? ULLONG_MAX : total * j;
+    }
+    return total;
+}
+
+// Recursive anagram search function (backtracking algorithm)
+// Parameters:
+//   - dict: words that fit the message (letters and counts only), in dictionary order
+//   - usable: positions in dict of the still usable words (ascending)
+//   - alpha_m: remaining message letters (letter-count vector)
+//   - anagram: positions in dict of the words already selected for the current anagram
+// Returns true if at least one anagram was found
+bool search_anagram(const Dictionary& dict, vector<int> usable, LetterCounts alpha_m, vector<int> anagram,
+                    const Options& options, SearchArena& arena)
+{
+    if (usable.empty())
+    {
+        return false; // No more words available, failure
+    }
+    bool success(false);
+    long long nb_required = options.required_words.size();
+    // Try each word in the dictionary (until an output, time or node limit is reached)
+    for (size_t i(0); (i < usable.size()) and !arena.sink.stopped; i++)
+    {
+        // Check if the word can be formed with remaining letters
+        if (message_contains_word(alpha_m, dict, usable[i]))
+        {
+            if ((arena.nodes >= arena.next_check) and ((options.time_limit != 0) or (options.node_limit != 0)) and
+                check_limits(options, arena))
+            {
+                break;
+            }
+            arena.nodes += 1;
+            // Create a new branch: add this word to the anagram
+            vector<int> next_anagram = anagram;
+            next_anagram.push_back(usable[i]);
+            // Remove used letters from the message
+            LetterCounts next_alpha_m = subtract_word_from_message(alpha_m, dict, usable[i]);
+            long long nb_words = nb_required + next_anagram.size();
+
+            if (counts_empty(next_alpha_m))
+            {
+                if (nb_words < options.min_words)
+                {
+                    continue; // Complete, but with too few words
+                }
+                // No remaining letters = complete anagram found!
+                arena.line.assign(options.prefix); // Required words first
+                for (size_t j(0); j < next_anagram.size(); j++)
+                {
+                    int k = next_anagram[j];
+                    arena.line.append(dict.pool.data() + dict.offsets[k], dict.offsets[k + 1] - dict.offsets[k]);
+                    arena.line.push_back(j != next_anagram.size() - 1 ? ' ' : '\n'); // Space between words
+                }
+                emit_anagram(arena.sink, arena.output, arena.line);
+                success = true;
+            }
+            else if ((options.max_words == 0) or (nb_words < options.max_words))
+            {
+                // Letters remain: continue search recursively
+                // Remove current word from the usable words to avoid duplicates
+                vector<int> next_usable = remove_word(usable, i);
+                if (search_anagram(dict, next_usable, next_alpha_m, next_anagram, options, arena))
+                {
+                    success = true;
+                }
+            }
+        }
+    }
+    return success;
+}
+
+// Stack-based anagram search (same results, in the same order, as search_anagram)
+// The dictionary is never copied: each depth keeps the indices of the classes that
+// still fit its remaining letters, stacked in the arena right after its parent's list.
+// A class can be chosen again at the next depth as long as some of its words are
+// unused; otherwise the child list drops it, so a word is never used twice.
+// A depth where a remaining letter is contained in no candidate is a dead end.
+//
+// Combination mode branches on a pivot letter: every anagram contains a word with
+// the remaining letter that the fewest candidates contain, so only the candidates
+// containing it (its posting list) are tried. The pivot stays the same, and its words
+// are chosen in class order, until all its copies are used; then the next pivot is
+// chosen. Each set of words is then found once instead of once per order. The words
+// of each class are only picked when the anagram is printed (see expand_anagram).
+// Returns true if at least one anagram was found
+bool search_anagram_stack(const ClassTable& classes, const vector<int>& candidates, const LetterCounts& alpha_m,
+                          size_t max_words, const Options& options, SearchArena& arena, const SearchIndex& index)
+{
+    if (!start_search(classes, candidates, alpha_m, max_words, options, arena))
+    {
+        return false; // A letter of the message is in no word
+    }
+    run_search(classes, options, arena, index, 0);
+    return arena.frames[0].found;
+}
+
+// Sizes the arena and prepares depth 0 with the candidates of the message
+// Returns false if a letter of the message is in no candidate
+bool start_search(const ClassTable& classes, const vector<int>& candidates, const LetterCounts& alpha_m,
+                  size_t max_words, const Options& options, SearchArena& arena)
+{
+    prepare_arena(arena, candidates.size(), max_words);
+    arena.nodes = 0;
+    arena.next_check = 0;
+    arena.log.clear();
+    arena.recorders = 0;
+    arena.memo.hits = 0;
+    arena.memo.misses = 0;
+    copy(candidates.begin(), candidates.end(), arena.candidates.begin());
+    SearchFrame& root = arena.frames[0];
+    root.remaining = alpha_m;
+    root.first = 0;
+    root.end = candidates.size();
+    root.found = false;
+    root.memo = false;
+    root.recording = false;
+    return prepare_frame(root, arena.candidates.data(), classes, -1, -1, options.required_words.size(), options,
+                         arena);
+}
+
+// Search loop: tries the candidates of the top frame of the arena and of the depths
+// it opens, until the frame of depth base has no candidate left
+// The depths above base belong to another task (parallel search) and are left alone.
+void run_search(const ClassTable& classes, const Options& options, SearchArena& arena, const SearchIndex& index,
+                int base)
+{
+    MemoTable& memo = arena.memo;
+    bool use_memo = !memo.entries.empty();
+    SearchFrame* frames = arena.frames.data();
+    int* list = arena.candidates.data();
+    bool has_limits = (options.time_limit != 0) or (options.node_limit != 0);
+    int depth(base);
+    while ((depth >= base) and !arena.sink.stopped)
+    {
+        if ((arena.scheduler != nullptr) and (arena.nodes >= arena.next_split))
+        {
+            // Once per SPLIT_INTERVAL nodes, not again while backtracking
+            arena.next_split = arena.nodes - arena.nodes % SPLIT_INTERVAL + SPLIT_INTERVAL;
+            if (arena.scheduler->stop)
+            {
+                arena.sink.stopped = true; // The output of the message is complete, or out of time
+                break;
+            }
+            split_search(arena, depth, base); // Share work with idle workers
+        }
+        SearchFrame& frame = frames[depth];
+        if (frame.next == frame.stop)
+        {
+            // All candidates tried: remember the result, then backtrack
+            if (frame.memo)
+            {
+                store_memo(memo, frame, depth, arena);
+            }
+            if (frame.recording)
+            {
+                arena.recorders -= 1;
+                if (arena.recorders == 0)
+                {
+                    arena.log.clear();
+                }
+            }
+            if ((depth > base) and frame.found)
+            {
+                frames[depth - 1].found = true;
+            }
+            depth -= 1;
+            continue;
+        }
+
+        if (has_limits and (arena.nodes >= arena.next_check) and check_limits(options, arena))
+        {
+            break; // Out of time or nodes
+        }
+        frame.chosen = list[frame.next];
+        frame.next += 1;
+        frame.uses = 1;
+        if ((depth > 0) and (frames[depth - 1].chosen == frame.chosen))
+        {
+            frame.uses += frames[depth - 1].uses; // Another word of the same class
+        }
+        arena.nodes += 1;
+        const AnagramClass& element = classes[frame.chosen];
+        SearchFrame& child = frames[depth + 1];
+        child.remaining = frame.remaining;
+        subtract_counts(child.remaining, element.counts);
+
+        int nb_words = options.required_words.size() + depth + 1; // Words of the anagram so far
+        if (counts_empty(child.remaining))
+        {
+            if (nb_words < options.min_words)
+            {
+                continue; // Complete, but with too few words
+            }
+            // No remaining letters = complete anagram found!
+            for (int j(0); j <= depth; j++)
+            {
+                arena.chosen[j] = frames[j].chosen;
+            }
+            log_anagram(arena, depth + 1);
+            expand_anagram(index, classes, depth + 1, options, arena);
+            frame.found = true;
+            continue;
+        }
+
+        // Keep the pivot while some of its copies remain, with classes from the chosen one on
+        bool same_pivot = (frame.pivot >= 0) and (child.remaining.count[frame.pivot] != 0);
+        child.key_class = same_pivot ? frame.chosen : -1;
+        child.key_detail = same_pivot ? frame.uses * NB_LETTERS + frame.pivot : -1;
+        if ((options.max_words != 0) and (options.max_words == options.min_words))
+        {
+            // Exact number of words: the anagrams below only depend on the number of words
+            // left, so the states stay valid for the other numbers of words (--fewest-words)
+            child.key_detail = (child.key_detail + 1) * (MAX_MESSAGE_LETTERS + 1) + (options.max_words - nb_words);
+        }
+        else if ((options.max_words != 0) or (options.min_words != 0))
+        {
+            // The anagrams below also depend on the number of words above
+            child.key_detail = (child.key_detail + 1) * (MAX_MESSAGE_LETTERS + 1) + nb_words;
+        }
+        child.memo = use_memo and is_clean(frames, depth, classes);
+        if (use_memo)
+        {
+            const MemoEntry* entry = find_memo(memo, child);
+            if ((entry != nullptr) and ((entry->solution_size == 0) or child.memo))
+            {
+                // Known state: dead end, or anagrams replayed after the current words
+                const int* solution = memo.solutions.data() + entry->first_solution;
+                const int* solution_end = solution + entry->solution_size;
+                while ((solution != solution_end) and !arena.sink.stopped)
+                {
+                    int nb_chosen(depth + 1); // Words of the replayed anagram
+                    for (int j(0); j <= depth; j++)
+                    {
+                        arena.chosen[j] = frames[j].chosen;
+                    }
+                    for (; *solution >= 0; solution++)
+                    {
+                        arena.chosen[nb_chosen] = *solution;
+                        nb_chosen += 1;
+                    }
+                    solution += 1; // Skip the end marker
+                    log_anagram(arena, nb_chosen);
+                    expand_anagram(index, classes, nb_chosen, options, arena);
+                    frame.found = true;
+                }
+                memo.hits += 1;
+                continue;
+            }
+            memo.misses += 1;
+        }
+
+        // Letters remain: keep the candidates that still fit, except the chosen
+        // class when all its words are used
+        child.first = max(frame.end, frame.stop);
+        bool exhausted = (frame.uses == element.size);
+        if ((options.max_words == options.min_words) and (options.max_words - nb_words == 1))
+        {
+            // Exactly one word left (--fewest-words): it must be made of all the remaining letters
+            child.end = child.first + keep_last_word(index, classes, list + frame.first, frame.end - frame.first,
+                                                     child.remaining, exhausted ? frame.chosen : -1,
+                                                     list + child.first);
+        }
+        else
+        {
+            child.end = child.first + keep_fitting(classes, list + frame.first, frame.end - frame.first,
+                                                   child.remaining, exhausted ? frame.chosen : -1, list + child.first);
+        }
+        child.found = false;
+        child.recording = false;
+        if (prepare_frame(child, list, classes, same_pivot ? frame.pivot : -1, same_pivot ? frame.chosen : -1,
+                          nb_words, options, arena))
+        {
+            // Go down one level, logging its anagrams if they may be cached
+            if (child.memo and (memo.max_solutions != 0) and (memo.solutions.size() < memo.max_solutions))
+            {
+                child.recording = true;
+                child.log_start = arena.log.size();
+                arena.recorders += 1;
+            }
+            depth += 1;
+        }
+        else if (child.memo)
+        {
+            store_memo(memo, child, depth + 1, arena); // Dead end
+        }
+    }
+    // Stopped by an output limit: the depths left on the stack are not stored, but
+    // the anagrams they found still count
+    for (; depth > base; depth--)
+    {
+        if (frames[depth].found)
+        {
+            frames[depth - 1].found = true;
+        }
+    }
+}
+
+// Parallel search: each candidate of depth 0 is a task, in search order; a worker
+// that finds idle workers gives them the candidates left at its shallowest depth
+// (see split_search). Every task prints into its own output chunk and the chunks
+// are printed in the order of the sequential search, as soon as they are done.
+// Each worker has its own arena and memo table.
+// A sharded search (--shard) only makes the tasks of the candidates of its shard, and
+// writes each chunk to the shard file as a block tagged with its candidate (see
+// AnagramEngine::write_shard and write_record).
+// Returns true if at least one anagram was found
+bool search_anagram_parallel(const ClassTable& classes, const vector<int>& candidates, const LetterCounts& alpha_m,
+                             size_t max_words, const Options& options, vector<SearchArena>& arenas,
+                             const SearchIndex& index)
+{
+    SearchArena& first = arenas[0];
+    string* output = first.output;
+    // Anagrams of the message so far (--fewest-words searches a message several times); the
+    // workers use the sink of the first arena, so it is kept here. The workers print into
+    // their chunks, which go to the output or to the callback of the engine.
+    OutputSink total(first.sink);
+    if (!start_search(classes, candidates, alpha_m, max_words, options, first))
+    {
+        return false; // A letter of the message is in no word
+    }
+    first.sink.callback = nullptr;
+    Scheduler scheduler;
+    vector<WorkerQueue> queues(arenas.size());
+    scheduler.queues.swap(queues);
+    scheduler.idle = 0;
+    scheduler.found = false;
+    scheduler.stop = false;
+    scheduler.nodes = 0;
+    scheduler.truncated = false;
+
+    // One task per candidate of depth 0 (of the shard), handed out in turn
+    const SearchFrame& root = first.frames[0];
+    const int* list = first.candidates.data();
+    ostream* shard_output = options.shard_output;
+    vector<int> shards;
+    if (shard_output != nullptr)
+    {
+        vector<uint64_t> costs = estimate_costs(classes, first);
+        shards = assign_shards(costs, options.shard_count);
+        uint64_t total_cost(0), own_cost(0);
+        long long own(0);
+        for (size_t k(0); k < costs.size(); k++)
+        {
+            total_cost += costs[k];
+            if (shards[k] == options.shard_index - 1)
+            {
+                own_cost += costs[k];
+                own += 1;
+            }
+        }
+        // Estimated cost of the shard, per million of the whole search
+        long long share = (total_cost > 0) ? (long long)((double)own_cost / total_cost * 1000000 + 0.5) : 0;
+        *shard_output << "plan " << costs.size() << ' ' << own << ' ' << share << '\n';
+    }
+    scheduler.pending = 0;
+    OutputChunk* head = nullptr;
+    OutputChunk* last = nullptr;
+    for (size_t i(root.next); i < root.stop; i++)
+    {
+        if (!shards.empty() and (shards[i - root.next] != options.shard_index - 1))
+        {
+            continue; // Searched by another shard
+        }
+        SearchTask* task = new SearchTask;
+        task->frame = root;
+        task->list.assign(list + root.first, list + root.end);
+        task->list.push_back(list[i]);
+        task->frame.first = 0;
+        task->frame.end = root.end - root.first;
+        task->frame.next = task->frame.end;
+        task->frame.stop = task->frame.end + 1;
+        task->chunk = insert_chunk(last);
+        task->chunk->position = i - root.next;
+        if (head == nullptr)
+        {
+            head = task->chunk;
+        }
+        last = task->chunk;
+        // The newest task of a queue is taken first: the first candidates are searched first
+        scheduler.queues[scheduler.pending % arenas.size()].tasks.push_front(task);
+        scheduler.pending += 1;
+    }
+    scheduler.queued = scheduler.pending.load();
+
+    vector<thread> workers;
+    for (size_t w(0); w < arenas.size(); w++)
+    {
+        SearchArena& arena = arenas[w];
+        prepare_arena(arena, candidates.size(), max_words);
+        arena.nodes = 0;
+        arena.memo.hits = 0;
+        arena.memo.misses = 0;
+        arena.scheduler = &scheduler;
+        arena.worker = w;
+        arena.deadline = first.deadline;
+        arena.next_check = 0;
+        arena.next_split = 0;
+        workers.push_back(thread(run_worker, cref(classes), cref(options), ref(arena), cref(index)));
+    }
+
+    // Print the chunks in order while the workers fill them
+    // Each worker keeps to the output limits within a chunk; the limits of the whole
+    // message are applied here (the callback of the engine gets the anagrams one by one),
+    // and the workers are stopped once they are reached
+    // A shard keeps to the limits within its own chunks: the anagrams it leaves out come
+    // after the ones the merge keeps
+    bool limited = (options.first != 0) or (options.max_bytes != 0) or (total.callback != nullptr);
+    string line;
+    string block;
+    OutputChunk* chunk = head;
+    while (chunk != nullptr)
+    {
+        unique_lock<mutex> guard(scheduler.lock);
+        scheduler.ready.wait(guard, [chunk] { return chunk->done; });
+        guard.unlock();
+        string* destination = (shard_output != nullptr) ? &block : output;
+        block.clear();
+        if (options.count_only)
+        {
+            add_anagrams(total, chunk->count);
+        }
+        else if (!limited)
+        {
+            if (!total.stopped)
+            {
+                write_output(total, destination, chunk->text);
+            }
+        }
+        else
+        {
+            for (size_t start(0); (start < chunk->text.size()) and !total.stopped;)
+            {
+                size_t end = chunk->text.find('\n', start) + 1;
+                line.assign(chunk->text, start, end - start);
+                emit_anagram(total, destination, line);
+                start = end;
+            }
+        }
+        if ((shard_output != nullptr) and ((chunk->count != 0) or !block.empty()))
+        {
+            write_record(*shard_output, "block " + to_string(chunk->position) + ' ' + to_string(chunk->count),
+                         block);
+        }
+        if (total.stopped or chunk->stopped or chunk->truncated)
+        {
+            // A chunk over a limit is also over it after the chunks before it, and the chunks
+            // after a truncated one are dropped, so a truncated search prints a prefix of the
+            // anagrams of the full search, as without --threads
+            total.stopped = true;
+            scheduler.stop = true;
+        }
+        OutputChunk* next = chunk->next;
+        delete chunk;
+        chunk = next;
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    for (size_t w(1); w < arenas.size(); w++)
+    {
+        first.nodes += arenas[w].nodes;
+        first.memo.hits += arenas[w].memo.hits;
+        first.memo.misses += arenas[w].memo.misses;
+    }
+    for (auto& arena : arenas)
+    {
+        arena.scheduler = nullptr;
+        arena.output = nullptr;
+    }
+    first.output = output;
+    first.sink = total;
+    first.sink.truncated = scheduler.truncated;
+    return scheduler.found;
+}
+
+// Worker of a parallel search: takes or steals tasks until all tasks are finished
+// A task restores its depth (and the words chosen above it) in the arena, then runs
+// the search loop down to that depth, printing into the task's output chunk.
+void run_worker(const ClassTable& classes, const Options& options, SearchArena& arena, const SearchIndex& index)
+{
+    Scheduler& scheduler = *arena.scheduler;
+    while (scheduler.pending > 0)
+    {
+        SearchTask* task = take_task(scheduler, arena.worker);
+        if (task == nullptr)
+        {
+            // Sleep until a busy worker gives a task (see split_search) or the search ends
+            return_nodes(options, arena);
+            unique_lock<mutex> guard(scheduler.lock);
+            scheduler.idle += 1;
+            scheduler.work.wait(guard, [&scheduler] { return (scheduler.queued > 0) or (scheduler.pending == 0); });
+            scheduler.idle -= 1;
+            continue;
+        }
+        int base = task->path.size();
+        for (int j(0); j < base; j++)
+        {
+            arena.frames[j] = task->path[j];
+        }
+        arena.frames[base] = task->frame;
+        arena.frames[base].found = false;
+        arena.frames[base].memo = false; // Only part of the candidates of this depth
+        arena.frames[base].recording = false;
+        copy(task->list.begin(), task->list.end(), arena.candidates.begin());
+        arena.log.clear();
+        arena.recorders = 0;
+        arena.chunk = task->chunk;
+        arena.output = &task->chunk->text;
+        reset_sink(arena.sink, options);
+        arena.sink.stopped = scheduler.stop;
+
+        run_search(classes, options, arena, index, base);
+        task->chunk->count = arena.sink.count;
+        task->chunk->stopped = arena.sink.stopped;
+        task->chunk->truncated = arena.sink.truncated;
+
+        if (arena.frames[base].found)
+        {
+            scheduler.found = true;
+        }
+        {
+            lock_guard<mutex> guard(scheduler.lock);
+            task->chunk->done = true;
+        }
+        scheduler.ready.notify_all();
+        delete task;
+        if ((scheduler.pending -= 1) == 0)
+        {
+            {
+                lock_guard<mutex> guard(scheduler.lock); // A waiting worker sees the end
+            }
+            scheduler.work.notify_all();
+        }
+    }
+    return_nodes(options, arena);
+}
+
+// Takes the newest task of the worker, or else steals the oldest task of another one
+SearchTask* take_task(Scheduler& scheduler, int worker)
+{
+    int nb_workers = scheduler.queues.size();
+    for (int k(0); k < nb_workers; k++)
+    {
+        WorkerQueue& queue = scheduler.queues[(worker + k) % nb_workers];
+        lock_guard<mutex> guard(queue.lock);
+        if (!queue.tasks.empty())
+        {
+            SearchTask* task;
+            if (k == 0)
+            {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            scheduler.queued -= 1;
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+// Gives the candidates left at the shallowest depth of the task (from base) to a new
+// task, if some worker is idle and this worker has no task waiting
+// Everything the worker still prints comes from the subtree it is in, which comes
+// before these candidates in search order: the new chunk goes right after its own.
+// The depths from base to the split one no longer see all their anagrams, so their
+// results are not stored in the memo table.
+void split_search(SearchArena& arena, int depth, int base)
+{
+    Scheduler& scheduler = *arena.scheduler;
+    if (scheduler.idle == 0)
+    {
+        return;
+    }
+    WorkerQueue& queue = scheduler.queues[arena.worker];
+    {
+        lock_guard<mutex> guard(queue.lock);
+        if (!queue.tasks.empty())
+        {
+            return;
+        }
+    }
+    SearchFrame* frames = arena.frames.data();
+    int split(base);
+    while ((split <= depth) and (frames[split].next == frames[split].stop))
+    {
+        split += 1;
+    }
+    if (split > depth)
+    {
+        return; // Nothing left to give
+    }
+    const int* list = arena.candidates.data();
+    const SearchFrame& frame = frames[split];
+    SearchTask* task = new SearchTask;
+    task->path.assign(frames, frames + split);
+    task->frame = frame;
+    task->list.assign(list + frame.first, list + frame.end);
+    task->list.insert(task->list.end(), list + frame.next, list + frame.stop);
+    task->frame.first = 0;
+    task->frame.end = frame.end - frame.first;
+    task->frame.next = task->frame.end;
+    task->frame.stop = task->frame.end + (frame.stop - frame.next);
+    task->chunk = insert_chunk(arena.chunk);
+    frames[split].stop = frames[split].next;
+    for (int j(base); j <= split; j++)
+    {
+        frames[j].memo = false;
+        if (frames[j].recording)
+        {
+            frames[j].recording = false;
+            arena.recorders -= 1;
+        }
+    }
+    if (arena.recorders == 0)
+    {
+        arena.log.clear();
+    }
+    scheduler.pending += 1;
+    {
+        lock_guard<mutex> guard(queue.lock);
+        queue.tasks.push_back(task);
+        scheduler.queued += 1;
+    }
+    {
+        lock_guard<mutex> guard(scheduler.lock); // A waiting worker sees the new task
+    }
+    scheduler.work.notify_one();
+}
+
+// Creates an empty output chunk, placed right after previous (if any)
+OutputChunk* insert_chunk(OutputChunk* previous)
+{
+    OutputChunk* chunk = new OutputChunk;
+    chunk->count = 0;
+    chunk->stopped = false;
+    chunk->truncated = false;
+    chunk->done = false;
+    chunk->next = nullptr;
+    chunk->position = 0;
+    if (previous != nullptr)
+    {
+        chunk->position = previous->position; // A split of the same subtree
+        chunk->next = previous->next;
+        previous->next = chunk;
+    }
+    return chunk;
+}
+
+// Estimated size of the subtree of each candidate tried at depth 0 of the arena (--shard):
+// the words that still fit after it, to the power of the number of words that the letters
+// left need at the average length of those words
+// The words that fit are counted on a sample of at most SHARD_SAMPLE candidates spread
+// over the list, so the estimate takes linear time. It is computed in integers, capped so
+// that the costs of all the candidates add up without overflow: every shard computes the
+// same estimates, whatever the machine or the compiler.
+vector<uint64_t> estimate_costs(const ClassTable& classes, const SearchArena& arena)
+{
+    const SearchFrame& root = arena.frames[0];
+    const int* list = arena.candidates.data();
+    size_t nb_candidates = root.end - root.first;
+    size_t step = max<size_t>(1, nb_candidates / SHARD_SAMPLE);
+    uint64_t cap = UINT64_MAX / (root.stop - root.next + 1); // The sums of the shards stay in range
+    vector<uint64_t> costs;
+    for (size_t i(root.next); i < root.stop; i++)
+    {
+        LetterCounts remaining = root.remaining;
+        subtract_counts(remaining, classes[list[i]].counts);
+        int nb_sampled(0), nb_fitting(0), letters(0);
+        for (size_t k(0); k < nb_candidates; k += step)
+        {
+            const LetterCounts& counts = classes[list[root.first + k]].counts;
+            nb_sampled += 1;
+            if (counts_contain(remaining, counts))
+            {
+                nb_fitting += 1;
+                letters += count_total(counts);
+            }
+        }
+        uint64_t cost(1);
+        if (nb_fitting != 0)
+        {
+            uint64_t fitting = (uint64_t)nb_fitting * nb_candidates / nb_sampled; // At least 1
+            int nb_words = (count_total(remaining) * nb_fitting + letters - 1) / letters; // Rounded up
+            for (int w(0); (w < nb_words) and (cost < cap); w++)
+            {
+                cost = (cost > cap / fitting) ? cap : cost * fitting;
+            }
+            cost = min(cost, cap - 1) + 1;
+        }
+        costs.push_back(cost);
+    }
+    return costs;
+}
+
+// Shard (from 0) of each candidate of depth 0: the candidates are taken from the most
+// costly one and each goes to the shard with the least cost so far (the first such shard
+// on a tie), so the shards get about the same cost whatever the number of candidates
+vector<int> assign_shards(const vector<uint64_t>& costs, int nb_shards)
+{
+    vector<int> order(costs.size());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&costs](int a, int b) { return costs[a] > costs[b]; });
+    vector<uint64_t> loads(nb_shards, 0);
+    vector<int> shards(costs.size());
+    for (auto k : order)
+    {
+        int shard = min_element(loads.begin(), loads.end()) - loads.begin();
+        shards[k] = shard;
+        loads[shard] += costs[k];
+    }
+    return shards;
+}
+
+// Prepares a depth whose candidate list [first, end) is in the arena
+// Counts the candidates containing each letter: if a remaining letter is in none of
+// them the depth is a dead end and false is returned.
+// In combination mode, the depth tries the candidates of its pivot letter (from class
+// min_class on), or of the rarest remaining letter if pivot is -1; this posting list
+// is written in the arena right after the candidate list.
+// Otherwise the depth tries all its candidates, in dictionary order.
+bool prepare_frame(SearchFrame& frame, int* list, const ClassTable& classes, int pivot, int min_class,
+                   int nb_words, const Options& options, SearchArena& arena)
+{
+    int total = count_total(frame.remaining);
+    arena.by_length.assign(total + 1, 0);
+    LetterCounts presence = {};
+    for (size_t i(frame.first); i < frame.end; i++)
+    {
+        const AnagramClass& element = classes[list[i]];
+        add_presence(presence, element.counts);
+        arena.by_length[count_total(element.counts)] += element.size; // Candidates fit: at most total
+    }
+    int rarest = choose_pivot(frame.remaining, presence);
+    if ((rarest < 0) or !length_reachable(arena.by_length, total, arena.reach) or
+        !words_within_limits(arena.by_length, total, nb_words, options))
+    {
+        return false;
+    }
+    if (!options.combinations)
+    {
+        frame.pivot = -1;
+        frame.next = frame.first;
+        frame.stop = frame.end;
+        return true;
+    }
+    frame.pivot = (pivot >= 0) ? pivot : rarest;
+    frame.next = frame.end;
+    frame.stop = frame.end;
+    for (size_t i(frame.first); i < frame.end; i++)
+    {
+        if ((list[i] >= min_class) and (classes[list[i]].counts.count[frame.pivot] != 0))
+        {
+            list[frame.stop] = list[i];
+            frame.stop += 1;
+        }
+    }
+    return frame.stop != frame.next;
+}
+
+// Checks that some words, by_length[l] of them having l letters, add up to exactly total
+// letters (subset sum by shift-or: bit n of reach is set when n letters can be reached).
+// The candidates of a depth include every word that can still be used below it, so an
+// unreachable total is a dead end even when each remaining letter is in some word.
+bool length_reachable(const vector<int>& by_length, int total, vector<uint64_t>& reach)
+{
+    if (by_length[total] != 0)
+    {
+        return true; // One word
+    }
+    size_t nb_blocks = total / 64 + 1;
+    reach.assign(nb_blocks, 0);
+    reach[0] = 1; // No word: 0 letters
+    for (int length(1); length < total; length++)
+    {
+        int copies = min(by_length[length], total / length);
+        size_t shift_blocks = length / 64;
+        int shift_bits = length % 64;
+        for (int k(0); k < copies; k++)
+        {
+            // reach |= reach << length, from the highest block down
+            for (size_t i(nb_blocks - 1); i + 1 > shift_blocks; i--)
+            {
+                uint64_t shifted = reach[i - shift_blocks] << shift_bits;
+                if ((shift_bits != 0) and (i > shift_blocks))
+                {
+                    shifted |= reach[i - shift_blocks - 1] >> (64 - shift_bits);
+                }
+                reach[i] |= shifted;
+            }
+            if ((reach[total / 64] >> (total % 64)) & 1)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Checks that the words of a depth (by_length[l] of them having l letters) can finish an
+// anagram of nb_words words so far within --max-words and --min-words: the longest words
+// give the fewest words that can cover total letters, the shortest ones the most.
+bool words_within_limits(const vector<int>& by_length, int total, int nb_words, const Options& options)
+{
+    if (options.max_words != 0)
+    {
+        int longest(total);
+        while (by_length[longest] == 0)
+        {
+            longest -= 1; // Some candidate exists, so this stops at 1 at the latest
+        }
+        if (nb_words + (total + longest - 1) / longest > options.max_words)
+        {
+            return false;
+        }
+    }
+    if (options.min_words != 0)
+    {
+        int most(0);
+        int letters(0);
+        for (int length(1); (length <= total) and (letters + length <= total); length++)
+        {
+            int copies = min(by_length[length], (total - letters) / length);
+            most += copies;
+            letters += copies * length;
+        }
+        if (nb_words + most < options.min_words)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the remaining letter contained in the fewest candidates
+// presence.count[l] is the number of candidates containing letter l (saturated at 255)
+// Returns -1 if a remaining letter is contained in no candidate
+int choose_pivot(const LetterCounts& remaining, const LetterCounts& presence)
+{
+    int pivot(-1);
+    for (int l(0); l < NB_LETTERS; l++)
+    {
+        if (remaining.count[l] != 0)
+        {
+            if (presence.count[l] == 0)
+            {
+                return -1; // This letter cannot be placed
+            }
+            if ((pivot < 0) or (presence.count[l] < presence.count[pivot]))
+            {
+                pivot = l;
+            }
+        }
+    }
+    return pivot;
+}
+
+// Prints all the anagrams made of the nb_words classes of arena.chosen
+// A class chosen k times gives k different words of the class: every combination of
+// k of its words is printed, for every class (Cartesian product).
+// In combination mode the classes are first put in dictionary order, so the words of
+// each line are in dictionary order. The last class changes fastest.
+void expand_anagram(const SearchIndex& index, const ClassTable& classes, int nb_words, const Options& options,
+                    SearchArena& arena)
+{
+    int* chosen = arena.chosen.data();
+    int* anagram = arena.anagram.data();
+    if (options.combinations)
+    {
+        sort(chosen, chosen + nb_words);
+    }
+    if (options.count_only)
+    {
+        add_anagrams(arena.sink, count_choices(classes, chosen, nb_words, options.permutations));
+        return;
+    }
+    int j(0);
+    int last(0);
+    do
+    {
+        // Reset the words from j onwards to the first words of their classes
+        for (int k(j); k < nb_words; k++)
+        {
+            if ((k > 0) and (chosen[k] == chosen[k - 1]))
+            {
+                anagram[k] = anagram[k - 1] + 1;
+            }
+            else
+            {
+                anagram[k] = classes[chosen[k]].first;
+            }
+        }
+        print_anagram(index, nb_words, options, arena);
+        if (arena.sink.stopped)
+        {
+            return;
+        }
+
+        // Find the last word that can still move to a later word of its class
+        // (the words after it in the same class need room after it)
+        j = nb_words - 1;
+        while (j >= 0)
+        {
+            last = j;
+            while ((last + 1 < nb_words) and (chosen[last + 1] == chosen[j]))
+            {
+                last += 1;
+            }
+            const AnagramClass& element = classes[chosen[j]];
+            if (anagram[j] < element.first + element.size - 1 - (last - j))
+            {
+                break;
+            }
+            j -= 1;
+        }
+        if (j >= 0)
+        {
+            anagram[j] += 1;
+            j += 1;
+        }
+    } while (j >= 0);
+}
+
+// Prints the nb_words words of arena.anagram on one line
+// With --permutations, the words (chosen in dictionary order) are printed in every
+// order, from the dictionary order to the reverse order
+void print_anagram(const SearchIndex& index, int nb_words, const Options& options, SearchArena& arena)
+{
+    int* anagram = arena.anagram.data();
+    do
+    {
+        arena.line.assign(options.prefix); // Required words first
+        for (int j(0); j < nb_words; j++)
+        {
+            append_word(arena.line, index, anagram[j]);
+            arena.line.push_back(j != nb_words - 1 ? ' ' : '\n'); // Space between words
+        }
+        emit_anagram(arena.sink, arena.output, arena.line);
+    } while (options.permutations and !arena.sink.stopped and next_permutation(anagram, anagram + nb_words));
+}
+
+// Allocates the memo table and the solution pool from the sizes given in the options
+void init_memo(MemoTable& memo, const Options& options, SearchArena& arena)
+{
+    size_t nb_entries(0);
+    size_t max_entries = options.memo_mb * 1024 * 1024 / sizeof(MemoEntry);
+    if (max_entries >= MEMO_WAYS)
+    {
+        nb_entries = MEMO_WAYS;
+        while (2 * nb_entries <= max_entries)
+        {
+            nb_entries *= 2;
+        }
+    }
+    MemoEntry empty = {};
+    empty.first_solution = -1;
+    memo.entries.assign(nb_entries, empty);
+    // The cached anagrams are found by int offsets (MemoEntry): the pool stops at INT_MAX
+    memo.max_solutions = (nb_entries == 0) ? 0 : min<long long>(options.cache_mb * 1024 * 1024 / sizeof(int), INT_MAX);
+    memo.solutions.clear();
+    memo.solutions.reserve(memo.max_solutions);
+    arena.log.reserve(memo.max_solutions);
+    memo.replace = 0;
+    memo.hits = 0;
+    memo.misses = 0;
+}
+
+// Hashes the key of a search state (remaining letters and pivot information)
+uint64_t hash_state(const LetterCounts& remaining, int key_class, int key_detail)
+{
+    uint64_t words[COUNTS_WIDTH / 8];
+    memcpy(words, remaining.count, COUNTS_WIDTH);
+    uint64_t h = (uint64_t(uint32_t(key_class)) << 32) ^ uint32_t(key_detail);
+    for (auto w : words)
+    {
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+// Looks up the state of a depth in the table (nullptr if unknown)
+const MemoEntry* find_memo(MemoTable& memo, const SearchFrame& frame)
+{
+    size_t bucket = hash_state(frame.remaining, frame.key_class, frame.key_detail) & (memo.entries.size() - 1);
+    bucket &= ~size_t(MEMO_WAYS - 1);
+    for (int way(0); way < MEMO_WAYS; way++)
+    {
+        const MemoEntry& entry = memo.entries[bucket + way];
+        if ((entry.first_solution >= 0) and (entry.key_class == frame.key_class) and
+            (entry.key_detail == frame.key_detail) and
+            (memcmp(entry.remaining.count, frame.remaining.count, COUNTS_WIDTH) == 0))
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+// Stores the result of a finished depth: dead end if nothing was found below it,
+// otherwise its anagrams if all of them were logged and fit in the solution pool
+void store_memo(MemoTable& memo, const SearchFrame& frame, int depth, SearchArena& arena)
+{
+    int first_solution = memo.solutions.size();
+    if (frame.found)
+    {
+        if (!frame.recording)
+        {
+            return; // Too many anagrams to cache
+        }
+        // Copy the logged anagrams without the words chosen above this depth
+        size_t i(frame.log_start);
+        while (i < arena.log.size())
+        {
+            size_t end(i);
+            while (arena.log[end] >= 0)
+            {
+                end += 1;
+            }
+            if (memo.solutions.size() + (end - i - depth) + 1 > memo.max_solutions)
+            {
+                memo.solutions.resize(first_solution); // Pool full
+                return;
+            }
+            memo.solutions.insert(memo.solutions.end(), arena.log.begin() + i + depth, arena.log.begin() + end);
+            memo.solutions.push_back(-1);
+            i = end + 1;
+        }
+    }
+    size_t bucket = hash_state(frame.remaining, frame.key_class, frame.key_detail) & (memo.entries.size() - 1);
+    bucket &= ~size_t(MEMO_WAYS - 1);
+    size_t slot = bucket + (memo.replace % MEMO_WAYS);
+    for (int way(0); way < MEMO_WAYS; way++)
+    {
+        if (memo.entries[bucket + way].first_solution < 0)
+        {
+            slot = bucket + way; // Free entry
+            break;
+        }
+    }
+    memo.replace += 1;
+    MemoEntry& entry = memo.entries[slot];
+    entry.remaining = frame.remaining;
+    entry.key_class = frame.key_class;
+    entry.key_detail = frame.key_detail;
+    entry.first_solution = first_solution;
+    entry.solution_size = memo.solutions.size() - first_solution;
+}
+
+// Checks that the anagrams below the child of depth only depend on its key
+// In combination mode the classes chosen above are either placed before the pivot
+// class or contain an exhausted pivot letter, so they never fit again. Otherwise the
+// state is clean when none of the words chosen above (one class per word) would fit.
+bool is_clean(const SearchFrame* frames, int depth, const ClassTable& classes)
+{
+    const SearchFrame& child = frames[depth + 1];
+    if (frames[depth].pivot >= 0)
+    {
+        return true;
+    }
+    for (int j(0); j <= depth; j++)
+    {
+        if (counts_contain(child.remaining, classes[frames[j].chosen].counts))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Appends the anagram in arena.chosen to the log if some depth is recording
+// If the log is full, recording stops for every depth
+void log_anagram(SearchArena& arena, int nb_words)
+{
+    if (arena.recorders == 0)
+    {
+        return;
+    }
+    if (arena.log.size() + nb_words + 1 > arena.memo.max_solutions)
+    {
+        for (auto& frame : arena.frames)
+        {
+            frame.recording = false;
+        }
+        arena.recorders = 0;
+        arena.log.clear();
+        return;
+    }
+    arena.log.insert(arena.log.end(), arena.chosen.begin(), arena.chosen.begin() + nb_words);
+    arena.log.push_back(-1);
+}
+
+// Sizes the arena for a search over nb_candidates classes whose anagrams have at most
+// max_words words (one word per depth); the list of a depth and its posting list are
+// never longer than the list of its parent
+void prepare_arena(SearchArena& arena, size_t nb_candidates, size_t max_words)
+{
+    size_t size = 2 * nb_candidates * (max_words + 1);
+    if (arena.frames.size() < max_words + 1)
+    {
+        arena.frames.resize(max_words + 1);
+        arena.chosen.resize(max_words + 1);
+        arena.anagram.resize(max_words + 1);
+    }
+    if (arena.candidates.size() < size)
+    {
+        arena.candidates.resize(size);
+    }
+}
+
+// Prints the anagram of a message whose letters are all used by the required words, if
+// it has an allowed number of words (NO_ANAGRAM otherwise)
+GranmaStatus write_required_only(const Options& options, SearchArena& arena)
+{
+    long long nb_words = options.required_words.size();
+    if ((nb_words < options.min_words) or ((options.max_words != 0) and (nb_words > options.max_words)))
+    {
+        return GranmaStatus::NO_ANAGRAM;
+    }
+    if (options.totals)
+    {
+        write_text(arena, "1 anagrams, 1 sets of words\n");
+    }
+    else
+    {
+        string line(options.prefix);
+        line.back() = '\n';
+        emit_anagram(arena.sink, arena.output, line);
+    }
+    return GranmaStatus::FOUND;
+}
+
+// Counting engine: prints the number of anagrams of the message (one per word order, as
+// listed by default) and the number of sets of words (as listed by --combinations),
+// without listing them. Prints the no-anagram message if there is none.
+GranmaStatus count_totals(const ClassTable& classes, const vector<int>& candidates, const LetterCounts& alpha_m,
+                          const Options& options, SearchArena& arena)
+{
+    CountTable table;
+    table.overflow = false;
+    CountKey key;
+    key.remaining = alpha_m;
+    key.pivot = -1;
+    key.min_class = -1;
+    arena.nodes = 0;
+    arena.next_check = 0;
+    const vector<AnagramCount>& by_words = count_state(classes, candidates, key, table, options, arena);
+    if (arena.sink.truncated)
+    {
+        return GranmaStatus::TRUNCATED; // Partial counts mean nothing
+    }
+
+    // A set of n different words gives n! word orders
+    bool permutations_overflow(table.overflow);
+    AnagramCount permutations(0);
+    AnagramCount combinations(0);
+    AnagramCount factorial(1);
+    long long nb_required = options.required_words.size();
+    for (size_t n(0); n < by_words.size(); n++)
+    {
+        factorial = multiply_count(factorial, max<size_t>(n, 1), permutations_overflow);
+        long long nb_words = nb_required + n;
+        if ((nb_words == 0) or (nb_words < options.min_words) or
+            ((options.max_words != 0) and (nb_words > options.max_words)))
+        {
+            continue; // An empty message has no anagram, as in the listing engines
+        }
+        combinations = add_count(combinations, by_words[n], table.overflow);
+        permutations = add_count(permutations, multiply_count(factorial, by_words[n], permutations_overflow),
+                                 permutations_overflow);
+    }
+    if (arena.stats != nullptr)
+    {
+        *arena.stats << "count states: " << table.states.size() << endl;
+    }
+    if (combinations == 0)
+    {
+        return GranmaStatus::NO_ANAGRAM;
+    }
+    write_text(arena, count_to_string(permutations, permutations_overflow) + " anagrams, " +
+                          count_to_string(combinations, table.overflow) + " sets of words\n");
+    return GranmaStatus::FOUND;
+}
+
+// Number of ways to finish the state of key, with n words for each n (result[n])
+// Same decomposition as the combination search: every anagram of the remaining letters
+// covers the pivot letter (the one contained in the fewest candidates) with words that
+// contain it. A pivot group takes each such class at most once, in class order from
+// key.min_class, with k of its words (C(size, k) choices). Once the pivot letter is
+// used up, the rest only depends on the remaining letters: each such state is counted
+// once, however many groups lead to it.
+// candidates: the classes that fit the remaining letters, in class order
+// Stops (returning table.none) once the time or node limit is reached; each new state is a node.
+const vector<AnagramCount>& count_state(const ClassTable& classes, const vector<int>& candidates, CountKey key,
+                                        CountTable& table, const Options& options, SearchArena& arena)
+{
+    if ((key.pivot >= 0) and (key.remaining.count[key.pivot] == 0))
+    {
+        key.pivot = -1; // End of the pivot group
+        key.min_class = -1;
+    }
+    auto known = table.states.find(key);
+    if (known != table.states.end())
+    {
+        return known->second;
+    }
+    if (arena.sink.truncated or ((arena.nodes >= arena.next_check) and
+                                 ((options.time_limit != 0) or (options.node_limit != 0)) and
+                                 check_limits(options, arena)))
+    {
+        return table.none;
+    }
+    arena.nodes += 1;
+
+    vector<AnagramCount> result;
+    if (key.pivot < 0)
+    {
+        if (counts_empty(key.remaining))
+        {
+            result.push_back(1); // One way: no more words
+        }
+        else
+        {
+            LetterCounts presence = {};
+            for (auto c : candidates)
+            {
+                add_presence(presence, classes[c].counts);
+            }
+            int pivot = choose_pivot(key.remaining, presence);
+            if (pivot >= 0) // Otherwise a letter is in no candidate: no way
+            {
+                CountKey group(key);
+                group.pivot = pivot;
+                group.min_class = 0;
+                result = count_state(classes, candidates, group, table, options, arena);
+            }
+        }
+    }
+    else
+    {
+        vector<int> fitting;
+        for (auto next = lower_bound(candidates.begin(), candidates.end(), key.min_class); next != candidates.end();
+             ++next)
+        {
+            int c = *next;
+            const AnagramClass& element = classes[c];
+            if (element.counts.count[key.pivot] == 0)
+            {
+                continue;
+            }
+            // Take k words of the class, for each k that fits
+            CountKey child(key);
+            child.min_class = c + 1;
+            AnagramCount choices(1);
+            for (int k(1); (k <= element.size) and counts_contain(child.remaining, element.counts); k++)
+            {
+                subtract_counts(child.remaining, element.counts);
+                choices = choices * (element.size - k + 1) / k; // C(size, k)
+                fitting.resize(candidates.size());
+                fitting.resize(keep_fitting(classes, candidates.data(), candidates.size(), child.remaining, -1,
+                                            fitting.data()));
+                const vector<AnagramCount>& rest = count_state(classes, fitting, child, table, options, arena);
+                if (result.size() < rest.size() + k)
+                {
+                    result.resize(rest.size() + k, 0);
+                }
+                for (size_t n(0); n < rest.size(); n++)
+                {
+                    result[n + k] = add_count(result[n + k], multiply_count(choices, rest[n], table.overflow),
+                                              table.overflow);
+                }
+            }
+        }
+    }
+    while (!result.empty() and (result.back() == 0))
+    {
+        result.pop_back();
+    }
+    return table.states.emplace(key, move(result)).first->second;
+}
+
+size_t CountKeyHash::operator()(const CountKey& key) const
+{
+    return hash_state(key.remaining, key.pivot, key.min_class);
+}
+
+bool CountKeyEqual::operator()(const CountKey& a, const CountKey& b) const
+{
+    return (memcmp(a.remaining.count, b.remaining.count, COUNTS_WIDTH) == 0) and (a.pivot == b.pivot) and
+           (a.min_class == b.min_class);
+}
+
+// Sum of two counts; saturates and sets overflow if it does not fit
+AnagramCount add_count(AnagramCount a, AnagramCount b, bool& overflow)
+{
+    AnagramCount sum = a + b;
+    if (sum < a)
+    {
+        overflow = true;
+        return ~AnagramCount(0);
+    }
+    return sum;
+}
+
+// Product of two counts; saturates and sets overflow if it does not fit
+AnagramCount multiply_count(AnagramCount a, AnagramCount b, bool& overflow)
+{
+    if ((a != 0) and (b > ~AnagramCount(0) / a))
+    {
+        overflow = true;
+        return ~AnagramCount(0);
+    }
+    return a * b;
+}
+
+// Decimal text of a count ("more than" the largest count if it overflowed)
+string count_to_string(AnagramCount value, bool overflow)
+{
+    string digits;
+    do
+    {
+        digits.push_back('0' + int(value % 10));
+        value /= 10;
+    } while (value != 0);
+    reverse(digits.begin(), digits.end());
+    return overflow ? TOO_MANY_ANAGRAMS + digits : digits;
+}
+
+// Prepares and launches anagram search for a message
+// Initializes structures and optimizes dictionary before recursive call
+// Prints the anagrams (or their numbers with --totals); the status says how the search
+// ended, and the caller prints its message
+GranmaStatus find_anagrams(const string& message, const SearchIndex& index, const ClassTable& classes,
+                           const Options& options, vector<SearchArena>& arenas)
+{
+    SearchArena& arena = arenas[0];
+    reset_sink(arena.sink, options);
+    arena.deadline = chrono::steady_clock::now() + chrono::milliseconds(options.time_limit);
+    LetterCounts alpha_m;
+    alpha_m = count_letters(message); // Count message letters
+    if (alpha_m.count[NB_LETTERS] != 0)
+    {
+        return GranmaStatus::TOO_MANY_LETTERS; // Letter counts do not fit in a byte
+    }
+    if (!options.required.empty())
+    {
+        // The letters of the required words are not searched
+        if (options.unusable or !counts_contain(alpha_m, options.required_counts))
+        {
+            return GranmaStatus::NO_ANAGRAM;
+        }
+        subtract_counts(alpha_m, options.required_counts);
+        if (counts_empty(alpha_m))
+        {
+            return write_required_only(options, arena);
+        }
+    }
+    size_t max_words(0);
+    if (options.totals)
+    {
+        // Counting engine, on the anagram classes whatever the search mode
+        const ClassTable& counted = options.banned.empty() ? index.classes : index.words;
+        vector<int> candidates = adapt_dictionary(index, counted, alpha_m, options, max_words);
+        return count_totals(counted, candidates, alpha_m, options, arena);
+    }
+    vector<int> candidates = adapt_dictionary(index, classes, alpha_m, options, max_words); // Optimization: keep possible words
+    max_words = min(max_words, message.size()); // A word has at least one letter
+
+    bool success;
+    if (options.fewest_words)
+    {
+        success = search_by_word_count(index, classes, candidates, alpha_m, max_words, options, arenas);
+    }
+    else
+    {
+        success = run_engine(index, classes, candidates, alpha_m, max_words, options, arenas);
+    }
+    if ((arena.stats != nullptr) and !options.recursive)
+    {
+        *arena.stats << "nodes: " << arena.nodes << ", memo hits: " << arena.memo.hits
+                     << ", memo misses: " << arena.memo.misses << endl;
+    }
+    if (arena.sink.truncated)
+    {
+        return GranmaStatus::TRUNCATED; // Not a proof that there are no (other) anagrams
+    }
+    return success ? GranmaStatus::FOUND : GranmaStatus::NO_ANAGRAM;
+}
+
+// Searches the candidates of a message with the engine chosen by the options: the
+// original recursive search, or the stack-based one on one or several threads
+// Returns true if at least one anagram was found
+bool run_engine(const SearchIndex& index, const ClassTable& classes, const vector<int>& candidates,
+                const LetterCounts& alpha_m, size_t max_words, const Options& options, vector<SearchArena>& arenas)
+{
+    SearchArena& arena = arenas[0];
+    bool success;
+    if (options.recursive)
+    {
+        // Original recursive search on a copy of the usable words (one class per word)
+        Dictionary adapted;
+        vector<int> usable(candidates.size());
+        for (size_t k(0); k < candidates.size(); k++)
+        {
+            int i = candidates[k];
+            int first = classes[i].first;
+            add_word(adapted, index.pool + index.offsets[first], index.offsets[first + 1] - index.offsets[first]);
+            adapted.counts.push_back(classes[i].counts);
+            usable[k] = k;
+        }
+        arena.nodes = 0;
+        arena.next_check = 0;
+        success = search_anagram(adapted, usable, alpha_m, vector<int>(), options, arena);
+    }
+    else
+    {
+        if ((arenas.size() > 1) or (options.shard_output != nullptr))
+        {
+            success = search_anagram_parallel(classes, candidates, alpha_m, max_words, options, arenas, index);
+        }
+        else
+        {
+            success = search_anagram_stack(classes, candidates, alpha_m, max_words, options, arena, index);
+        }
+    }
+    return success;
+}
+
+// Fewest-words-first search (iterative deepening on the number of words): the message is
+// searched for anagrams of exactly 1 word, then exactly 2 words, and so on, each search
+// printing its anagrams (and flushing them) before the next one starts. Short anagrams
+// come first even when the dictionary order would reach them after long chains of short
+// words. The searches share the memo table: with an exact number of words, a state is
+// keyed by the number of words left (see run_search), so a dead end found for 3 words
+// is not searched again by the search for 4 words.
+// The word counts go from --min-words (or 1) to --max-words, or to the most words the
+// candidates can make; the output, time and node limits apply to the whole message.
+// Returns true if at least one anagram was found
+bool search_by_word_count(const SearchIndex& index, const ClassTable& classes, const vector<int>& candidates,
+                          const LetterCounts& alpha_m, size_t max_words, const Options& options,
+                          vector<SearchArena>& arenas)
+{
+    SearchArena& arena = arenas[0];
+    long long nb_required = options.required_words.size();
+    // Most words: every letter in a word of the shortest candidate length
+    int shortest(MAX_MESSAGE_LETTERS);
+    for (auto c : candidates)
+    {
+        shortest = min(shortest, count_total(classes[c].counts));
+    }
+    long long most = nb_required + min<long long>(max_words, count_total(alpha_m) / max(shortest, 1));
+    if (options.max_words != 0)
+    {
+        most = min(most, options.max_words);
+    }
+    Options exact(options);
+    bool success(false);
+    long long nodes(0), hits(0), misses(0);
+    for (long long nb_words = max(options.min_words, nb_required + 1); (nb_words <= most) and !arena.sink.stopped;
+         nb_words++)
+    {
+        exact.min_words = nb_words;
+        exact.max_words = nb_words;
+        if (options.node_limit != 0)
+        {
+            exact.node_limit = options.node_limit - nodes; // What the searches before left
+            if (exact.node_limit <= 0)
+            {
+                arena.sink.stopped = true;
+                arena.sink.truncated = true;
+                break;
+            }
+        }
+        if (run_engine(index, classes, candidates, alpha_m, max_words, exact, arenas))
+        {
+            success = true;
+        }
+        nodes += arena.nodes;
+        hits += arena.memo.hits;
+        misses += arena.memo.misses;
+        if ((arena.output == nullptr) and (arena.sink.callback == nullptr))
+        {
+            arena.sink.stream->flush(); // The anagrams of this number of words are complete
+        }
+    }
+    arena.nodes = nodes;
+    arena.memo.hits = hits;
+    arena.memo.misses = misses;
+    return success;
+}
+
+// Checks that the message (words separated by white space) is uppercase, then searches
+// and displays its anagrams, and how the search ended
+// Returns how the search ended (NOT_IN_CAPITAL_LETTERS if the message was not searched)
+GranmaStatus process_message(const string& message, const SearchIndex& index, const ClassTable& classes,
+                             const Options& options, vector<SearchArena>& arenas)
+{
+    SearchArena& arena = arenas[0];
+    string letters; // Concatenation of all words of the message into a single string
+    if (!is_all_uppercase(message, arena, letters))
+    {
+        return GranmaStatus::NOT_IN_CAPITAL_LETTERS;
+    }
+    // Search and display of anagrams, then of how the search ended
+    GranmaStatus status = find_anagrams(letters, index, classes, options, arenas);
+    write_text(arena, status_lines(status, options, arena.sink.count));
+    return status;
+}
+
+// Lines printed after the anagrams of a message: the no-anagram message, the number of
+// anagrams with --count (those found so far if truncated), then the truncation status
+string status_lines(GranmaStatus status, const Options& options, unsigned long long count)
+{
+    string text;
+    if ((status == GranmaStatus::NO_ANAGRAM) or (status == GranmaStatus::TOO_MANY_LETTERS))
+    {
+        text += status_text(status) + "\n";
+    }
+    else if (options.count_only and !options.totals)
+    {
+        text += to_string(count) + "\n";
+    }
+    if (status == GranmaStatus::TRUNCATED)
+    {
+        text += status_text(status) + "\n";
+    }
+    return text;
+}
+
+// Chooses the class table searched
+// Anagram classes: the combination search works on groups of words with the same
+// letters, the other searches on one class per word (their output order depends on it).
+// A class is all or none of its words: with required or excluded words, each word is
+// a class on its own.
+const ClassTable& select_classes(const SearchIndex& index, const Options& options)
+{
+    return (options.combinations and !options.recursive and options.banned.empty()) ? index.classes : index.words;
+}
+
+// Optimizes the dictionary by keeping only the classes whose words can be formed
+// with the message letters (improves performance)
+// The trie yields them without looking at the words that need missing letters; with
+// one class per word (classes is index.words), each anagram class gives its words.
+// Words shorter than --min-length, and required or excluded words, are left out (then
+// classes is index.words).
+// Returns their indices, in dictionary order, and counts their words in max_words
+vector<int> adapt_dictionary(const SearchIndex& index, const ClassTable& classes, const LetterCounts& alpha_m,
+                             const Options& options, size_t& max_words)
+{
+    vector<int> found;
+    vector<uint32_t> stack;
+    walk_trie(index, alpha_m, found, stack);
+    vector<int> candidates;
+    max_words = 0;
+    for (auto c : found)
+    {
+        const AnagramClass& element = index.classes[c];
+        if (count_total(element.counts) < options.min_length)
+        {
+            continue;
+        }
+        if (classes.data == index.classes.data)
+        {
+            candidates.push_back(c);
+            max_words += element.size;
+            continue;
+        }
+        for (int i(0); i < element.size; i++)
+        {
+            if (options.banned.empty() or !options.banned[element.first + i])
+            {
+                candidates.push_back(element.first + i);
+                max_words += 1;
+            }
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+    return candidates;
+}
+
+// Removes the i-th word from the usable words
+// Used to avoid reusing a word already in the anagram
+vector<int> remove_word(vector<int> usable, int i)
+{
+    // Shift all following elements to the left
+    for (size_t j(i); j < usable.size() - 1; j++)
+    {
+        usable[j] = usable[j + 1];
+    }
+    usable.pop_back(); // Remove last element
+    return usable;
+}
+
+// Milliseconds elapsed since start
+double elapsed_ms(chrono::steady_clock::time_point start)
+{
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Writes a record of a shard file: the header, the size of the payload, then the payload
+void write_record(ostream& file, const string& header, const string& payload)
+{
+    file << header << ' ' << payload.size() << '\n' << payload;
+}
+
+} // namespace granma
+
+// === LIBRARY INTERFACE (Same-Granma.h) ===
+
+using namespace granma;
+
+// Message printed by the program for a status (empty for FOUND)
+const string& status_text(GranmaStatus status)
+{
+    static const string none;
+    switch (status)
+    {
+    case GranmaStatus::NO_ANAGRAM:
+        return NO_ANAGRAM;
+    case GranmaStatus::TRUNCATED:
+        return SEARCH_TRUNCATED;
+    case GranmaStatus::NOT_IN_CAPITAL_LETTERS:
+        return NOT_IN_CAPITAL_LETTERS;
+    case GranmaStatus::DOUBLE_WORD:
+        return DOUBLE_WORD;
+    case GranmaStatus::EMPTY_DICT:
+        return EMPTY_DICT;
+    case GranmaStatus::TOO_MANY_LETTERS:
+        return TOO_MANY_LETTERS;
+    case GranmaStatus::INVALID_INDEX:
+        return INVALID_INDEX;
+    case GranmaStatus::INVALID_SETTINGS:
+        return INVALID_SETTINGS;
+    default:
+        return none;
+    }
+}
+
+// Dictionary and search memory of an AnagramEngine
+struct EngineState
+{
+    SearchIndex index;         // Sorted dictionary (built from the words or mapped)
+    Options options;           // Options of the searches, with the constraints resolved
+    const ClassTable* classes; // Classes searched (see select_classes)
+    vector<vector<SearchArena>> idle; // Arenas of the searches not running (guarded by lock)
+    mutex lock;
+
+    ~EngineState() { release_index(index); }
+};
+
+namespace granma
+{
+
+// Options of the searches of an engine for its settings
+Options settings_options(const EngineSettings& settings)
+{
+    Options options = default_options();
+    options.recursive = settings.recursive;
+    options.combinations = settings.combinations or settings.permutations;
+    options.permutations = settings.permutations;
+    options.fewest_words = settings.fewest_words;
+    options.count_only = settings.count;
+    options.totals = settings.totals;
+    options.memo_mb = settings.memo_mb;
+    options.cache_mb = settings.cache_mb;
+    options.threads = settings.threads;
+    options.first = settings.first;
+    options.max_bytes = settings.max_bytes;
+    options.max_words = settings.max_words;
+    options.min_words = settings.min_words;
+    options.min_length = settings.min_length;
+    options.time_limit = settings.time_limit;
+    options.node_limit = settings.node_limit;
+    options.shard_index = settings.shard_index;
+    options.shard_count = settings.shard_count;
+    options.required = settings.required;
+    options.excluded = settings.excluded;
+    return options;
+}
+
+// Checks the options made from the settings of an engine, as the command line checks its
+// options: the values in range, and the required and excluded words in capitals
+bool valid_options(const Options& options)
+{
+    bool valid = (options.memo_mb >= 0) and (options.memo_mb <= 1024 * 1024) and (options.cache_mb >= 0) and
+                 (options.cache_mb <= 1024 * 1024) and (options.threads >= 1) and (options.threads <= 1024) and
+                 (options.first >= 0) and (options.max_bytes >= 0) and (options.time_limit >= 0) and
+                 (options.node_limit >= 0);
+    for (auto limit : {options.max_words, options.min_words, options.min_length})
+    {
+        valid = valid and (limit >= 0) and (limit <= MAX_MESSAGE_LETTERS);
+    }
+    for (auto& element : options.required)
+    {
+        valid = valid and is_capital_letter(element);
+    }
+    for (auto& element : options.excluded)
+    {
+        valid = valid and is_capital_letter(element);
+    }
+    if (options.shard_count != 0)
+    {
+        valid = valid and (options.shard_index >= 1) and (options.shard_index <= options.shard_count) and
+                (options.shard_count <= 1000000) and !options.recursive and !options.fewest_words and
+                !options.totals;
+    }
+    return valid;
+}
+
+// Takes the arenas of a search (one per thread) from the idle ones of the engine, or makes
+// new ones; the anagrams are printed to out, and the statistics to stats (if not nullptr)
+vector<SearchArena> take_arenas(EngineState& state, ostream* out, ostream* stats)
+{
+    vector<SearchArena> arenas;
+    {
+        lock_guard<mutex> guard(state.lock);
+        if (!state.idle.empty())
+        {
+            arenas.swap(state.idle.back());
+            state.idle.pop_back();
+        }
+    }
+    if (arenas.empty())
+    {
+        arenas.resize(state.options.threads);
+        for (auto& arena : arenas)
+        {
+            init_memo(arena.memo, state.options, arena);
+            arena.scheduler = nullptr;
+        }
+    }
+    for (auto& arena : arenas)
+    {
+        arena.output = nullptr;
+        arena.stats = stats;
+        arena.sink.callback = nullptr;
+        arena.sink.stream = out;
+    }
+    return arenas;
+}
+
+// Gives the arenas of a search back to the engine, with their memo tables, for the next
+// searches
+void return_arenas(EngineState& state, vector<SearchArena>& arenas)
+{
+    lock_guard<mutex> guard(state.lock);
+    state.idle.push_back(move(arenas));
+}
+
+// Searches a message with arenas of the engine and prints what the program prints for it,
+// to out or into output (if not nullptr); the anagrams go to the sink instead if there is one
+GranmaStatus search_engine(EngineState& state, const string& message, ostream* out, string* output,
+                           const AnagramSink* sink, ostream* stats)
+{
+    vector<SearchArena> arenas = take_arenas(state, out, stats);
+    arenas[0].output = output;
+    arenas[0].sink.callback = sink;
+    GranmaStatus status = process_message(message, state.index, *state.classes, state.options, arenas);
+    arenas[0].sink.callback = nullptr;
+    return_arenas(state, arenas);
+    return status;
+}
+
+} // namespace granma
+
+// Default settings of the engine: those of the program without options
+EngineSettings::EngineSettings()
+{
+    Options defaults = default_options();
+    recursive = defaults.recursive;
+    combinations = defaults.combinations;
+    permutations = defaults.permutations;
+    fewest_words = defaults.fewest_words;
+    count = defaults.count_only;
+    totals = defaults.totals;
+    memo_mb = defaults.memo_mb;
+    cache_mb = defaults.cache_mb;
+    threads = defaults.threads;
+    first = defaults.first;
+    max_bytes = defaults.max_bytes;
+    max_words = defaults.max_words;
+    min_words = defaults.min_words;
+    min_length = defaults.min_length;
+    time_limit = defaults.time_limit;
+    node_limit = defaults.node_limit;
+    shard_index = defaults.shard_index;
+    shard_count = defaults.shard_count;
+}
+
+AnagramEngine::AnagramEngine()
+{
+}
+
+AnagramEngine::~AnagramEngine()
+{
+}
+
+// Checks, converts, sorts and indexes the words, as the program does with its dictionary
+GranmaStatus AnagramEngine::load_words(const vector<string>& words, const EngineSettings& settings)
+{
+    size_t next(0);
+    return load_source(
+        [&words, &next](string& word)
+        {
+            if (next == words.size())
+            {
+                return false;
+            }
+            word = words[next++];
+            return true;
+        },
+        settings);
+}
+
+// Same with the words given one by one (the program reads them from standard input)
+GranmaStatus AnagramEngine::load_source(const WordSource& source, const EngineSettings& settings)
+{
+    Dictionary dict;
+    bool capitals = create_dictionary(source, dict); // The program stops reading at a word not in capitals
+    convert(dict);
+    sort_dictionary(dict);
+    GranmaStatus status = check_dictionary(dict, capitals);
+    if (status != GranmaStatus::FOUND)
+    {
+        return status;
+    }
+    unique_ptr<EngineState> loaded(new EngineState);
+    create_index(dict, loaded->index);
+    return configure(loaded, settings);
+}
+
+// Maps an index file written by --build-index (the mapping stays with the engine)
+GranmaStatus AnagramEngine::load_index(const string& path, const EngineSettings& settings)
+{
+    unique_ptr<EngineState> loaded(new EngineState);
+    if (!map_index(path, loaded->index))
+    {
+        return GranmaStatus::INVALID_INDEX;
+    }
+    return configure(loaded, settings);
+}
+
+// Turns the settings into the options of the searches of a loaded dictionary and resolves
+// the required and excluded words on it, then makes it the dictionary of the engine
+// If the settings are not valid, the dictionary already loaded stays (loaded is dropped)
+GranmaStatus AnagramEngine::configure(unique_ptr<EngineState>& loaded, const EngineSettings& settings)
+{
+    Options& options = loaded->options;
+    options = settings_options(settings);
+    if (!valid_options(options))
+    {
+        return GranmaStatus::INVALID_SETTINGS;
+    }
+    resolve_constraints(loaded->index, options);
+    loaded->classes = &select_classes(loaded->index, options);
+    state.swap(loaded); // The old dictionary goes with loaded
+    return GranmaStatus::FOUND;
+}
+
+// Writes the dictionary to an index file (nothing is written if none is loaded)
+bool AnagramEngine::write_index(const string& path) const
+{
+    return state and granma::write_index(state->index, path);
+}
+
+// Searches a message with arenas of the engine (taken from the idle ones, or new), and
+// gives its anagrams to the sink; the status texts of the program are not printed
+GranmaStatus AnagramEngine::search(const string& message, const AnagramSink& sink)
+{
+    if (!state)
+    {
+        return GranmaStatus::EMPTY_DICT; // No dictionary loaded
+    }
+    string discarded; // Text printed by the program around the anagrams
+    return search_engine(*state, message, nullptr, &discarded, &sink, nullptr);
+}
+
+// Displays the sorted dictionary
+void AnagramEngine::print_dictionary(ostream& out) const
+{
+    if (state)
+    {
+        display_dictionary(state->index, out);
+    }
+}
+
+// Searches a message and prints its anagrams and how its search ended to out
+GranmaStatus AnagramEngine::print(const string& message, ostream& out, ostream* stats)
+{
+    if (!state)
+    {
+        return GranmaStatus::EMPTY_DICT;
+    }
+    return search_engine(*state, message, &out, nullptr, nullptr, stats);
+}
+
+// Same, at the end of output
+GranmaStatus AnagramEngine::print(const string& message, string& output, ostream* stats)
+{
+    if (!state)
+    {
+        return GranmaStatus::EMPTY_DICT;
+    }
+    return search_engine(*state, message, nullptr, &output, nullptr, stats);
+}
+
+// Starts a shard file (see write_shard): the shard, the output limits of the search, and
+// the display of the dictionary
+void AnagramEngine::write_shard_header(ostream& file) const
+{
+    if (!state)
+    {
+        return;
+    }
+    const Options& options = state->options;
+    file << SHARD_MAGIC << ' ' << options.shard_index << ' ' << options.shard_count << ' ' << options.first << ' '
+         << options.max_bytes << ' ' << options.count_only << '\n';
+    ostringstream dictionary;
+    display_dictionary(state->index, dictionary);
+    write_record(file, "dictionary", dictionary.str());
+}
+
+// Sharded search (--shard I/N): the candidates of depth 0 of each message are split
+// between N shards by their estimated cost (see estimate_costs and assign_shards), the
+// same way by every shard, and this engine only searches those of shard I. The shards
+// can run as separate processes, on other machines too; merge_shards then prints from
+// their files exactly what one process prints.
+// The shard file is a list of records: a header line of numbers, followed by a payload
+// when the last number is a size:
+//   granma-shard I N FIRST MAX_BYTES COUNT  the shard, and the output limits of the search
+//   dictionary SIZE                         the display of the dictionary
+//   message J                               start of the J-th message (from 0)
+//   plan CANDIDATES OWN SHARE               candidates of depth 0, those of the shard and
+//                                           its part of the estimated cost, per million
+//   block POSITION COUNT SIZE               anagrams found below a candidate of depth 0
+//   end STATUS COUNT SIZE                   how the search ended (status + 1, 0 if not
+//                                           searched), then the anagram count and the text
+//                                           printed outside the blocks
+//   stats NODES HITS MISSES MICROSECONDS    statistics of the message on this shard
+// Writes the records of the j-th message; returns how its search ended
+GranmaStatus AnagramEngine::write_shard(size_t j, const string& message, ostream& file, ostream* stats)
+{
+    if (!state)
+    {
+        return GranmaStatus::EMPTY_DICT;
+    }
+    if (state->options.shard_count == 0)
+    {
+        return GranmaStatus::INVALID_SETTINGS; // Not a sharded search
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    file << "message " << j << '\n';
+    Options options(state->options);
+    options.shard_output = &file; // The parallel search writes its blocks there
+    vector<SearchArena> arenas = take_arenas(*state, nullptr, stats);
+    SearchArena& arena = arenas[0];
+    string text;
+    arena.output = &text;
+    arena.nodes = 0;
+    arena.memo.hits = 0;
+    arena.memo.misses = 0;
+    reset_sink(arena.sink, options);
+    string letters;
+    GranmaStatus status(GranmaStatus::NOT_IN_CAPITAL_LETTERS);
+    int searched(0);
+    if (is_all_uppercase(message, arena, letters))
+    {
+        status = find_anagrams(letters, state->index, *state->classes, options, arenas);
+        searched = (int)status + 1;
+    }
+    arena.output = nullptr;
+    write_record(file, "end " + to_string(searched) + ' ' + to_string(arena.sink.count), text);
+    file << "stats " << arena.nodes << ' ' << arena.memo.hits << ' ' << arena.memo.misses << ' '
+         << (long long)(elapsed_ms(start) * 1000) << '\n';
+    file.flush();
+    return_arenas(*state, arenas);
+    return status;
+}
+
+// Number of words of the dictionary
+size_t AnagramEngine::nb_words() const
+{
+    return state ? state->index.nb_words : 0;
+}
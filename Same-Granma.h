@@ -0,0 +1,129 @@
+// Same-Granma.h
+// Guillaume-Gentil Robin
+// Anagram search engine of Same-Granma, for use inside another program
+//
+// The engine is Same-Granma.cc; the program is the engine with its command line,
+// Same-Granma-CLI.cc, and its tools, Same-Granma-Tools.cc. For another program, compile
+// the engine alone:
+//   g++ -std=c++11 -O2 -pthread -c Same-Granma.cc -o same-granma.o
+// It never reads standard input and only prints to the streams it is given: anagrams go
+// to a callback or a stream and every error is a status. See LICENSE AND COPYRIGHT in
+// Same-Granma.cc.
+
+#ifndef SAME_GRANMA_H
+#define SAME_GRANMA_H
+
+#include <cstddef>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Result of a call to the engine
+enum class GranmaStatus
+{
+    FOUND,                  // The search found anagrams (or the dictionary is loaded)
+    NO_ANAGRAM,             // The search ended without any anagram
+    TRUNCATED,              // The time or node limit stopped the search (anagrams may be missing)
+    NOT_IN_CAPITAL_LETTERS, // A word of the dictionary or of the message is not in capital letters
+    DOUBLE_WORD,            // A word is twice in the dictionary
+    EMPTY_DICT,             // The dictionary has no word (or no dictionary is loaded)
+    TOO_MANY_LETTERS,       // A letter appears more than 255 times in the message
+    INVALID_INDEX,          // The index file cannot be read or is not an index file
+    INVALID_SETTINGS        // A setting is out of range, or a required or excluded word is not in capitals
+};
+
+// Message printed by the program for a status (empty for FOUND)
+const std::string& status_text(GranmaStatus status);
+
+// Receives each anagram found, its words separated by spaces
+// Returning false stops the search (its status is then FOUND)
+typedef std::function<bool(const std::string& anagram)> AnagramSink;
+
+// Gives the words of a dictionary one by one, into word
+// Returns false when there is no word left
+typedef std::function<bool(std::string& word)> WordSource;
+
+// Settings of the searches of an engine (same meaning and defaults as the command-line
+// options of the same name; 0 = no limit)
+struct EngineSettings
+{
+    bool recursive;        // --recursive: the original recursive search (one thread)
+    bool combinations;     // --combinations: each set of words once, in dictionary order
+    bool permutations;     // --permutations: every word order of each set, grouped by set
+    bool fewest_words;     // --fewest-words: the anagrams of 1 word first, then of 2 words...
+    bool count;            // --count: print the number of anagrams instead of the anagrams
+    bool totals;           // --totals: print the numbers of anagrams and of sets of words
+    long long memo_mb;     // --memo: size of the table of known states of each search thread
+    long long cache_mb;    // --cache: size of the cache of anagrams of known states (with --memo)
+    long long threads;     // --threads: number of threads searching each message
+    long long first;       // --first: stop after this number of anagrams
+    long long max_bytes;   // --max-bytes: stop before the anagrams printed exceed this size
+    long long max_words;   // --max-words
+    long long min_words;   // --min-words
+    long long min_length;  // --min-length
+    long long time_limit;  // --time-limit, in milliseconds
+    long long node_limit;  // --node-limit
+    long long shard_index; // --shard I/N: the shard written by write_shard (from 1)...
+    long long shard_count; // ...and the number of shards (0 = not sharded)
+    std::vector<std::string> required; // --require: words that every anagram contains (first)
+    std::vector<std::string> excluded; // --exclude: words that no anagram contains
+
+    EngineSettings(); // Default settings of the program
+};
+
+struct EngineState; // Dictionary and search memory of an engine (Same-Granma.cc)
+
+// Anagram search engine on one dictionary
+// Load a dictionary first; then several threads can search at the same time, each search
+// keeping its memory (memo tables) for the next ones. Loading again replaces the
+// dictionary and must not happen during a search; a load that fails keeps the dictionary
+// already loaded.
+class AnagramEngine
+{
+public:
+    AnagramEngine();
+    ~AnagramEngine();
+
+    // Checks, sorts and indexes a list of words (the dictionary of the program), given as a
+    // vector or one by one by a source
+    GranmaStatus load_words(const std::vector<std::string>& words, const EngineSettings& settings);
+    GranmaStatus load_source(const WordSource& source, const EngineSettings& settings);
+
+    // Maps an index file written by --build-index
+    GranmaStatus load_index(const std::string& path, const EngineSettings& settings);
+
+    // Writes the dictionary to an index file (--build-index)
+    // Returns false if the file cannot be written
+    bool write_index(const std::string& path) const;
+
+    // Searches the anagrams of a message (words in capital letters separated by spaces)
+    // and gives them to the sink, in the order the program prints them
+    GranmaStatus search(const std::string& message, const AnagramSink& sink);
+
+    // Prints the sorted dictionary, one word per line (step 3 of the program)
+    void print_dictionary(std::ostream& out) const;
+
+    // Searches a message and prints what the program prints for it: its anagrams (or their
+    // numbers), then how the search ended; to out or at the end of output
+    // stats: where the statistics of the search are printed (--stats), or nullptr
+    GranmaStatus print(const std::string& message, std::ostream& out, std::ostream* stats = nullptr);
+    GranmaStatus print(const std::string& message, std::string& output, std::ostream* stats = nullptr);
+
+    // Shard file of the search (--shard): its header, with the display of the dictionary,
+    // then the records of the j-th message (from 0), which the program merges (--merge)
+    // stats: as for print
+    void write_shard_header(std::ostream& file) const;
+    GranmaStatus write_shard(std::size_t j, const std::string& message, std::ostream& file,
+                             std::ostream* stats = nullptr);
+
+    // Number of words of the dictionary (0 if none is loaded)
+    std::size_t nb_words() const;
+
+private:
+    GranmaStatus configure(std::unique_ptr<EngineState>& loaded, const EngineSettings& settings);
+    std::unique_ptr<EngineState> state;
+};
+
+#endif